@@ -46,6 +46,10 @@
 #define ID_XU_OUT       51
 #define ID_XU_IN        52
 
+/* MEM request offset to the mixer unit. A GET returns its range (as in a RANGE request) then every weight,
+ * in node order. A SET writes pairs of node number and weight */
+#define MEM_OFFSET_MIXER_WEIGHTS 2
+
 #define OFFSET_BLENGTH 0
 #define OFFSET_BDESCRIPTORTYPE 1
 #define OFFSET_BDESCRIPTORSUBTYPE 2
@@ -66,6 +70,7 @@ typedef struct
     double max;
     double res;
     double weight;
+    unsigned int dirty;     /* Changed since usb_mixer_begin() */
 } mixer_node;
 
 typedef struct 
@@ -79,6 +84,7 @@ typedef struct
     char output_names[USB_MIXER_INPUTS][USB_MIXER_MAX_NAME_LEN];
     unsigned int num_inPins;
     mixer_node nodes[USB_MIXER_INPUTS * USB_MIXER_OUTPUTS];
+    unsigned int in_transaction;
 } usb_mixer_device;
 
 typedef struct {
@@ -101,6 +107,7 @@ typedef struct
     char inputStrings[USB_MIXER_INPUTS*4][USB_MIXER_MAX_NAME_LEN];   /* Complete list of all possible inputs */
     unsigned int numOutputs;
     unsigned int state[USB_MIXER_INPUTS];
+    unsigned int dirty[USB_MIXER_INPUTS];   /* Changed since usb_mixer_begin() */
 } t_usb_mixSel;
 
 typedef struct {
@@ -285,11 +292,73 @@ static int dev_set_channel_map(int channel, int val, int unitId)
     return 0;
 }
 
+/* Populates min, max, res and weight for every node from a single request.
+ * Returns USB_MIXER_FAILURE if the device does not support it */
+static int dev_get_mixer_weights(unsigned int mixer)
+{
+    usb_mixer_device *usb_mixer = &usb_mixers->usb_mixer[mixer];
+    unsigned int num_nodes = usb_mixer->num_inputs * usb_mixer->num_outputs;
+    short data[4 + USB_MIXER_INPUTS * USB_MIXER_OUTPUTS];
+    unsigned int length = (4 + num_nodes) * 2;
+
+    if (num_nodes > USB_MIXER_INPUTS * USB_MIXER_OUTPUTS)
+    {
+        return USB_MIXER_FAILURE;
+    }
+
+    /* Devices without this request return no data */
+#if defined(__APPLE__)
+    int received = libusb_control_transfer(devh,
+                            USB_REQUEST_FROM_DEV,
+                            MEM,
+                            MEM_OFFSET_MIXER_WEIGHTS,               /* wValue */
+                            (usb_mixer->id & 0xff) << 8 | 0x0,      /* wIndex */
+                            (unsigned char *) data,
+                            length,
+                            0);
+    if (received != (int) length)
+    {
+        return USB_MIXER_FAILURE;
+    }
+#elif defined(_WIN32)
+    unsigned int received = 0;
+    TUsbAudioStatus st = gDrvApi.TUSBAUDIO_AudioControlRequestGet(devh,
+                            usb_mixer->id,
+                            MEM,
+                            0,                                      // cs
+                            MEM_OFFSET_MIXER_WEIGHTS,               // cn
+                            data,
+                            length,
+                            &received,
+                            1000);
+    if (TSTATUS_SUCCESS != st || received != length)
+    {
+        return USB_MIXER_FAILURE;
+    }
+#endif
+
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        usb_mixer->nodes[i].min = (double)data[1]/256;
+        usb_mixer->nodes[i].max = (double)data[2]/256;
+        usb_mixer->nodes[i].res = (double)data[3]/256;
+        usb_mixer->nodes[i].weight = (double)data[4 + i]/256;
+    }
+
+    return USB_MIXER_SUCCESS;
+}
+
 static int mixer_update_all_nodes(unsigned int mixer_index) 
 {
     int i = 0;
     int j = 0;
     double min, max, res;
+
+    /* Read every node at once where the device allows, otherwise one node at a time */
+    if (dev_get_mixer_weights(mixer_index) == USB_MIXER_SUCCESS)
+    {
+        return 0;
+    }
  
     for (i = 0; i < usb_mixers->usb_mixer[mixer_index].num_inputs; i++) 
     {
@@ -905,16 +974,25 @@ unsigned char usb_mixsel_get_state(unsigned int mixer, unsigned int channel)
     return usb_mixers->usb_mixSel[mixer].state[channel];
 }
 
-void usb_mixsel_set_state(unsigned int mixer, unsigned int dst, unsigned int src)
+static void dev_set_mixsel_state(unsigned int mixer, unsigned int dst, unsigned int src)
 {
-    // Write to device
     // Note, we are updating inputs to all mixers here with a hard-coded 0, though the device allows
     // for separate input mapping per mixer
-    unsigned bRequest = CUR; 
-    unsigned cs = 0;
-    unsigned cn = usb_mixers->usb_mixSel[mixer].id;
     unsigned wLength = 1;
     usb_audio_class_set(CUR, 0, dst, usb_mixers->usb_mixSel[mixer].id, wLength, (unsigned char *)&src);
+}
+
+void usb_mixsel_set_state(unsigned int mixer, unsigned int dst, unsigned int src)
+{
+    // Write to device, or leave it to usb_mixer_commit()
+    if (usb_mixers->usb_mixer[mixer].in_transaction)
+    {
+        usb_mixers->usb_mixSel[mixer].dirty[dst] = 1;
+    }
+    else
+    {
+        dev_set_mixsel_state(mixer, dst, src);
+    }
 
     // Update object state
     usb_mixers->usb_mixSel[mixer].state[dst] = src;
@@ -944,6 +1022,15 @@ double usb_mixer_get_max(unsigned int mixer, unsigned int nodeId)
     return (double)usb_mixers->usb_mixer[mixer].nodes[nodeId].max;
 }
 
+static void dev_set_mixer_value(unsigned int mixer, unsigned int nodeId, double val)
+{
+    short value = (short) (val * 256);
+
+    unsigned char cs = 0; /* Device doesnt use CS for setting/getting mixer nodes */
+    unsigned char cn = nodeId & 0xff;
+    usb_audio_class_set(CUR, cs, cn, usb_mixers->usb_mixer[mixer].id,  2, (unsigned char *)&value);
+}
+
 int usb_mixer_set_value(unsigned int mixer, unsigned int nodeId, double val) 
 {
     /* check if update required */
@@ -952,17 +1039,115 @@ int usb_mixer_set_value(unsigned int mixer, unsigned int nodeId, double val)
         /* update local object */
         usb_mixers->usb_mixer[mixer].nodes[nodeId].weight= val;
 
-        /* write to device */
-        short value = (short) (val * 256);
-       
-        unsigned char cs = 0; /* Device doesnt use CS for setting/getting mixer nodes */ 
-        unsigned char cn = nodeId & 0xff;
-        usb_audio_class_set(CUR, cs, cn, usb_mixers->usb_mixer[mixer].id,  2, (unsigned char *)&value);
-        
+        /* write to device, or leave it to usb_mixer_commit() */
+        if (usb_mixers->usb_mixer[mixer].in_transaction)
+        {
+            usb_mixers->usb_mixer[mixer].nodes[nodeId].dirty = 1;
+        }
+        else
+        {
+            dev_set_mixer_value(mixer, nodeId, val);
+        }
     }
     return 0;
 }
 
+int usb_mixer_begin(unsigned int mixer)
+{
+    usb_mixers->usb_mixer[mixer].in_transaction = 1;
+    return USB_MIXER_SUCCESS;
+}
+
+/* Writes every changed node with a single request.
+ * Returns USB_MIXER_FAILURE if the device does not support it */
+static int dev_set_mixer_weights(unsigned int mixer)
+{
+    usb_mixer_device *usb_mixer = &usb_mixers->usb_mixer[mixer];
+    unsigned short data[USB_MIXER_INPUTS * USB_MIXER_OUTPUTS * 2];
+    unsigned int length = 0;
+
+    /* Pairs of node number and weight */
+    for (unsigned int i = 0; i < USB_MIXER_INPUTS * USB_MIXER_OUTPUTS; i++)
+    {
+        if (usb_mixer->nodes[i].dirty)
+        {
+            data[length++] = i;
+            data[length++] = (unsigned short)(short)(usb_mixer->nodes[i].weight * 256);
+        }
+    }
+    length *= 2;
+
+    if (length == 0)
+    {
+        return USB_MIXER_SUCCESS;
+    }
+
+#if defined(__APPLE__)
+    /* Devices without this request stall it */
+    if (libusb_control_transfer(devh,
+                            USB_REQUEST_TO_DEV,
+                            MEM,
+                            MEM_OFFSET_MIXER_WEIGHTS,               /* wValue */
+                            (usb_mixer->id & 0xff) << 8 | 0x0,      /* wIndex */
+                            (unsigned char *) data,
+                            length,
+                            0) != (int) length)
+    {
+        return USB_MIXER_FAILURE;
+    }
+#elif defined(_WIN32)
+    if (TSTATUS_SUCCESS != gDrvApi.TUSBAUDIO_AudioControlRequestSet(devh,
+                            usb_mixer->id,
+                            MEM,
+                            0,                                      // cs
+                            MEM_OFFSET_MIXER_WEIGHTS,               // cn
+                            data,
+                            length,
+                            NULL,
+                            1000))
+    {
+        return USB_MIXER_FAILURE;
+    }
+#endif
+    return USB_MIXER_SUCCESS;
+}
+
+int usb_mixer_commit(unsigned int mixer)
+{
+    usb_mixer_device *usb_mixer = &usb_mixers->usb_mixer[mixer];
+    t_usb_mixSel *usb_mixSel = &usb_mixers->usb_mixSel[mixer];
+
+    /* Mix selections first so the new weights apply to the new inputs */
+    for (unsigned int i = 0; i < USB_MIXER_INPUTS; i++)
+    {
+        if (usb_mixSel->dirty[i])
+        {
+            dev_set_mixsel_state(mixer, i, usb_mixSel->state[i]);
+            usb_mixSel->dirty[i] = 0;
+        }
+    }
+
+    /* All the weights at once where the device allows, otherwise one node at a time */
+    if (dev_set_mixer_weights(mixer) != USB_MIXER_SUCCESS)
+    {
+        for (unsigned int i = 0; i < USB_MIXER_INPUTS * USB_MIXER_OUTPUTS; i++)
+        {
+            if (usb_mixer->nodes[i].dirty)
+            {
+                dev_set_mixer_value(mixer, i, usb_mixer->nodes[i].weight);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < USB_MIXER_INPUTS * USB_MIXER_OUTPUTS; i++)
+    {
+        usb_mixer->nodes[i].dirty = 0;
+    }
+    usb_mixer->in_transaction = 0;
+
+    return USB_MIXER_SUCCESS;
+}
+
 int usb_mixer_get_range(unsigned int mixer, unsigned int mixer_unit, int *min, int *max, int *res) 
 {
     // range 0x02
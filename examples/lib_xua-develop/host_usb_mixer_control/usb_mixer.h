@@ -52,6 +52,14 @@ double usb_mixer_get_value(unsigned int mixer, unsigned int mixer_unit);
 /* Sets the current value for a selected mixer unit */
 int usb_mixer_set_value(unsigned int mixer, unsigned int mixer_unit, double val);
 
+/* Starts a transaction on a selected mixer. Until usb_mixer_commit() is called, mixer
+ * values and mix selections are only cached */
+int usb_mixer_begin(unsigned int mixer);
+
+/* Writes every value and mix selection changed since usb_mixer_begin() to the device,
+ * with the mixer values in a single request */
+int usb_mixer_commit(unsigned int mixer);
+
 /* Returns the range values for a selected mixer unit */
 int usb_mixer_get_range(unsigned int mixer, unsigned int mixer_unit, double *min, double *max, double *res);
 
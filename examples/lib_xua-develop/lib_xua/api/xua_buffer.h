@@ -117,5 +117,15 @@ void XUA_Buffer_Decouple(chanend c_audio_out
      , chanend c_buff_ctrl
 #endif
 );
+
+#if XUA_DECOUPLE_BRIDGE || defined(__DOXYGEN__)
+/** Pass frames of samples between XUA_Buffer_Decouple() and the mixer() or audio() threads when
+ *  XUA_DECOUPLE_BLOCK is enabled and they are on different tiles. Must run on AUDIO_IO_TILE.
+ *
+ * \param c_mix_out Channel connected to XUA_Buffer_Decouple()
+ * \param c_aud     Channel connected to the audio() or mixer() threads
+ */
+void XUA_DecoupleBridge(chanend c_mix_out, chanend c_aud);
+#endif
 #endif
 #endif
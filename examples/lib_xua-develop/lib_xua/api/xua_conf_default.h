@@ -589,6 +589,58 @@
 #define XUA_QUAD_SPI_FLASH (1)
 #endif
 
+/**
+ * @brief DFU transfer size in bytes, advertised as wTransferSize in the DFU functional descriptor.
+ *
+ * Between 64 and 4096, and either 64 or 128 or a multiple of the 256 byte flash page size.
+ * Transfers shorter than a page are buffered and written a whole page at a time. Larger
+ * transfers reduce the number of control transfers (and GETSTATUS round trips) needed for an
+ * upgrade at the cost of RAM for the transfer buffers, and are needed for delta updates, which
+ * write whole pages in one request. Products opt in once their DFU hosts are known to handle
+ * them. Hosts may still use shorter transfers.
+ *
+ * Default: 64
+ */
+#ifndef XUA_DFU_TRANSFER_SIZE
+#define XUA_DFU_TRANSFER_SIZE (64)
+#endif
+
+/**
+ * @brief Allow an upgrade image to be downloaded in the background, while audio keeps streaming.
+ *
+ * The host starts a background download with the XMOS_DFU_BACKGROUND request rather than
+ * DFU_DETACH. Each block is programmed a slice at a time as the host polls DFU_GETSTATUS, and
+ * the image is booted after the next reset. Not supported when AudioHub runs the DFU handler
+ * (AUDIO_IO_TILE is 0 and XUD_TILE is not), or when the flash shares ports with audio.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_DFU_BACKGROUND
+#define XUA_DFU_BACKGROUND (0)
+#endif
+
+/**
+ * @brief Maximum percentage of time the flash is busy during a background download.
+ *
+ * Sets the bwPollTimeout reported after each slice from the time the slice took.
+ *
+ * Default: 25
+ */
+#ifndef XUA_DFU_BACKGROUND_DUTY
+#define XUA_DFU_BACKGROUND_DUTY (25)
+#endif
+
+/**
+ * @brief Bytes of a DFU_DNLOAD block programmed per slice of a background download.
+ *
+ * Must be a multiple of 4. A slice which reaches a new flash sector also erases it.
+ *
+ * Default: 256
+ */
+#ifndef XUA_DFU_BACKGROUND_SLICE_BYTES
+#define XUA_DFU_BACKGROUND_SLICE_BYTES (256)
+#endif
+
 /**
  * @brief Enable HID playback controls functionality.
  *
@@ -1225,6 +1277,207 @@
     #define MIX_INPUTS                 (18)
 #endif
 
+/**
+ * @brief Only multiply-accumulate the mixer inputs with a non-zero weight. Each mix keeps a
+ *        list of its non-zero inputs, rebuilt when a weight or input mapping changes.
+ *        Faster than the full mix when most weights are zero, e.g. an identity matrix
+ *        plus a few sends, but slower when most are non-zero.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_MIXER_SPARSE
+    #define XUA_MIXER_SPARSE           (0)
+#endif
+
+/**
+ * @brief Compute all the mixes together with the xcore.ai vector unit, in a single mixer
+ *        thread. Only available on xcore.ai devices, for up to 8 mixes.
+ *
+ * The result is not bit exact with the full mix, see the mixer documentation.
+ *
+ * Default: 1 (Enabled) for xcore.ai devices with 1 to 8 mixes, unless XUA_MIXER_SPARSE is enabled
+ *          or XUA_MIXER_THREADS is defined, else 0
+ */
+#ifndef XUA_MIXER_VPU
+    #if defined(__XS3A__) && (MAX_MIX_COUNT > 0) && (MAX_MIX_COUNT <= 8) && (XUA_MIXER_SPARSE == 0) && !defined(XUA_MIXER_THREADS)
+        #define XUA_MIXER_VPU          (1)
+    #else
+        #define XUA_MIXER_VPU          (0)
+    #endif
+#endif
+
+/**
+ * @brief Number of threads the mixes are shared between. Mix n is computed by thread
+ *        (n % XUA_MIXER_THREADS), the first of which also exchanges samples with the
+ *        decouple and AudioHub threads.
+ *
+ * Default: 2 if MIXER enabled, else 1. 1 if XUA_MIXER_VPU is enabled.
+ */
+#ifndef XUA_MIXER_THREADS
+    #if (MAX_MIX_COUNT > 1) && (XUA_MIXER_VPU == 0)
+        #define XUA_MIXER_THREADS      (2)
+    #else
+        #define XUA_MIXER_THREADS      (1)
+    #endif
+#endif
+
+/**
+ * @brief Number of mixes computed at sample rates above 96kHz. Each mixer thread has
+ *        time for one mix at these rates, so more mixer threads allow more mixes.
+ *
+ * Default: XUA_MIXER_THREADS, or MAX_MIX_COUNT if XUA_MIXER_VPU is enabled
+ */
+#ifndef XUA_MIXER_HIGH_RATE_MIX_COUNT
+    #if (XUA_MIXER_VPU)
+        #define XUA_MIXER_HIGH_RATE_MIX_COUNT  (MAX_MIX_COUNT)
+    #else
+        #define XUA_MIXER_HIGH_RATE_MIX_COUNT  (XUA_MIXER_THREADS)
+    #endif
+#endif
+
+/**
+ * @brief Number of samples per block of the block level meters. When non-zero the mixer hands
+ *        each complete frame of its sources to a separate meter thread, which computes the peak
+ *        and RMS level of each stream from the host, device input and mix over every block. Must
+ *        be at least the number of meters. This replaces the per-sample peak tracking of
+ *        LEVEL_METER_HOST.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_LEVEL_METER_BLOCK
+    #define XUA_LEVEL_METER_BLOCK      (0)
+#endif
+
+/* Decouple defines */
+
+/**
+ * @brief Number of samples per frame exchanged between the decouple thread and the mixer, or the
+ *        AudioHub if the mixer is disabled. When non-zero the samples are passed through double
+ *        buffered shared memory with one channel handshake per frame, rather than over the channel
+ *        every sample. Adds up to 2 * XUA_DECOUPLE_BLOCK samples of latency in each direction.
+ *        When XUD_TILE is not the same as AUDIO_IO_TILE the frames cannot be shared, so an extra
+ *        thread on AUDIO_IO_TILE passes each frame across the tiles over the channel (see
+ *        XUA_DECOUPLE_BRIDGE). Must not exceed XUA_DECOUPLE_BLOCK_MAX.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_DECOUPLE_BLOCK
+    #define XUA_DECOUPLE_BLOCK         (0)
+#endif
+
+/**
+ * @brief Set when XUA_DECOUPLE_BLOCK is enabled and XUD_TILE is not the same as AUDIO_IO_TILE.
+ *        XUA_DecoupleBridge() then runs in an extra thread on AUDIO_IO_TILE, exchanging frames
+ *        with the mixer/AudioHub through that tile's memory and passing each frame to and from
+ *        decouple as a single burst over the channel, closed by one control token.
+ */
+#if (XUA_DECOUPLE_BLOCK > 0) && XUA_USB_EN && (XUD_TILE != AUDIO_IO_TILE)
+    #define XUA_DECOUPLE_BRIDGE        (1)
+#else
+    #define XUA_DECOUPLE_BRIDGE        (0)
+#endif
+
+/**
+ * @brief Largest supported XUA_DECOUPLE_BLOCK. The decouple interrupt handler processes a whole
+ *        frame without returning to its main loop, which must service the USB endpoints every
+ *        microframe. Handling a sample takes less than a sample period at MAX_FREQ, so a frame of
+ *        at most one microframe of samples at MAX_FREQ keeps the handler under 125us.
+ */
+#define XUA_DECOUPLE_BLOCK_MAX         (MAX_FREQ / 8000)
+
+/**
+ * @brief Enables the low latency mode of the host to device (OUT) buffer. Rather than always
+ *        prefilling one packet of the largest size, the buffer is prefilled to a target number of
+ *        packets. The target is lowered at each stream start while the host jitter observed during
+ *        the last stream left spare packets in the buffer, and falls back to the full depth after any
+ *        underflow while streaming. The target can also be read and set with the
+ *        XUA_REQUEST_GET_LATENCY and XUA_REQUEST_SET_LATENCY vendor requests.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_LOW_LATENCY
+    #define XUA_LOW_LATENCY            (0)
+#endif
+
+/**
+ * @brief Initial OUT buffer prefill target of XUA_LOW_LATENCY, in packets (microframes at high-speed)
+ *
+ * Default: 4
+ */
+#ifndef XUA_LOW_LATENCY_PREFILL
+    #define XUA_LOW_LATENCY_PREFILL    (4)
+#endif
+
+/**
+ * @brief Lowest OUT buffer prefill target of XUA_LOW_LATENCY, in packets
+ *
+ * Default: 2
+ */
+#ifndef XUA_LOW_LATENCY_PREFILL_MIN
+    #define XUA_LOW_LATENCY_PREFILL_MIN (2)
+#endif
+
+/**
+ * @brief Device vendor request returning the XUA_LOW_LATENCY state: the prefill target, prefill and
+ *        packet size in bytes and the number of underflows, then histograms of the lowest and highest
+ *        buffer fill, in packets, over each window of packets. All 32-bit words.
+ *
+ * Default: 0xE0
+ */
+#ifndef XUA_REQUEST_GET_LATENCY
+    #define XUA_REQUEST_GET_LATENCY    (0xE0)
+#endif
+
+/**
+ * @brief Device vendor request setting the XUA_LOW_LATENCY prefill target to wValue packets, from the
+ *        next stream start
+ *
+ * Default: 0xE1
+ */
+#ifndef XUA_REQUEST_SET_LATENCY
+    #define XUA_REQUEST_SET_LATENCY    (0xE1)
+#endif
+
+/**
+ * @brief Enables decouple buffer telemetry: counts of underflow and overflow events in each
+ *        direction, the lowest and highest buffer fill over each interval and a history of the
+ *        feedback value. Read with the XUA_REQUEST_GET_TELEMETRY vendor request and, when built with
+ *        XSCOPE defined, sent on xSCOPE probes at the end of each interval.
+ *
+ * Default: 0 (Disabled)
+ */
+#ifndef XUA_DECOUPLE_TELEMETRY
+    #define XUA_DECOUPLE_TELEMETRY     (0)
+#endif
+
+/**
+ * @brief Length of an XUA_DECOUPLE_TELEMETRY interval in milliseconds
+ *
+ * Default: 100
+ */
+#ifndef XUA_DECOUPLE_TELEMETRY_INTERVAL_MS
+    #define XUA_DECOUPLE_TELEMETRY_INTERVAL_MS (100)
+#endif
+
+/**
+ * @brief Number of intervals of feedback value history kept by XUA_DECOUPLE_TELEMETRY
+ *
+ * Default: 16
+ */
+#ifndef XUA_DECOUPLE_TELEMETRY_HISTORY
+    #define XUA_DECOUPLE_TELEMETRY_HISTORY (16)
+#endif
+
+/**
+ * @brief Device vendor request returning the XUA_DECOUPLE_TELEMETRY state as 32-bit words, in the
+ *        order of the XUA_TELEMETRY_* indexes in xua_commands.h
+ *
+ * Default: 0xE2
+ */
+#ifndef XUA_REQUEST_GET_TELEMETRY
+    #define XUA_REQUEST_GET_TELEMETRY  (0xE2)
+#endif
+
 /* Volume processing defines */
 
 /**
@@ -1401,6 +1654,24 @@ enum USBEndpointNumber_Out
 #define ENDPOINT_COUNT_IN                 (XUA_ENDPOINT_COUNT_IN + XUA_ENDPOINT_COUNT_CUSTOM_IN)
 #define ENDPOINT_COUNT_OUT                (XUA_ENDPOINT_COUNT_OUT + XUA_ENDPOINT_COUNT_CUSTOM_OUT)
 
+/* xSCOPE probes registered by xscope_user_init() when built with XSCOPE defined */
+enum
+{
+#if (XUA_DFU_EN == 1) && (XUA_DFU_BACKGROUND == 1)
+    XUA_XSCOPE_DFU_BACKGROUND,      /* Time in us the flash was busy for a background DFU slice */
+#endif
+#if (XUA_DECOUPLE_TELEMETRY) && (XUA_USB_EN)
+    XUA_XSCOPE_DECOUPLE_OUT_FILL_MIN,   /* Lowest OUT buffer fill in bytes over the interval */
+    XUA_XSCOPE_DECOUPLE_OUT_FILL_MAX,   /* Highest OUT buffer fill in bytes over the interval */
+    XUA_XSCOPE_DECOUPLE_IN_FILL_MIN,    /* Lowest IN buffer fill in bytes over the interval */
+    XUA_XSCOPE_DECOUPLE_IN_FILL_MAX,    /* Highest IN buffer fill in bytes over the interval */
+    XUA_XSCOPE_DECOUPLE_FEEDBACK,       /* Feedback value (16.16 samples per packet) */
+    XUA_XSCOPE_DECOUPLE_UNDERFLOWS,     /* Underflow events, both directions, since boot */
+    XUA_XSCOPE_DECOUPLE_OVERFLOWS,      /* Overflow events, both directions, since boot */
+#endif
+    XUA_XSCOPE_PROBE_COUNT          /* End marker */
+};
+
 #endif /* __ASSEMBLER__ */
 
 #define AUDIO_STOP_FOR_DFU                (0x12345678)
@@ -14,7 +14,9 @@ enum mix_ctl_cmd {
   SET_MIX_OUT_VOL,
   GET_INPUT_LEVELS,
   GET_STREAM_LEVELS,
-  GET_OUTPUT_LEVELS
+  GET_OUTPUT_LEVELS,
+  SET_MIX_MULTS,
+  GET_METER_LEVELS
 };
 
 
@@ -38,6 +40,16 @@ void mixer(chanend c_to_host, chanend c_to_audio, chanend c_mix_ctl);
 #define XUA_MIXER_OFFSET_MIX        (NUM_USB_CHAN_OUT + NUM_USB_CHAN_IN)
 #define XUA_MIXER_OFFSET_OFF        (NUM_USB_CHAN_OUT + NUM_USB_CHAN_IN + MAX_MIX_COUNT)
 
+/* Block level meters, one per mixer source other than "off" (see XUA_LEVEL_METER_BLOCK) */
+#define XUA_MIXER_METER_COUNT       (XUA_MIXER_OFFSET_OFF)
+
+/* Number of meter levels returned by each GET_METER_LEVELS command */
+#define XUA_MIXER_METER_LEVELS_PER_CMD  (8)
+
+/* Maximum number of weights carried by each SET_MIX_MULTS command, which bounds the time
+ * the mixer spends handling it between samples */
+#define XUA_MIXER_MULTS_PER_CMD     (8)
+
 /* Defines uses for DB to actual muliplier conversion */
 #define XUA_MIXER_MULT_FRAC_BITS    (25)
 #define XUA_MIXER_DB_FRAC_BITS      (8)
@@ -1,6 +1,7 @@
 // Copyright 2012-2024 XMOS LIMITED.
 // This Software is subject to the terms of the XMOS Public Licence: Version 1.
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -18,14 +19,27 @@
 
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 void Sleep(unsigned milliseconds) {
     usleep(milliseconds * 1000);
 }
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "libusb.h"
 
+#ifndef LIBUSB_CALL
+#define LIBUSB_CALL
+#endif
+
 /* the device's vendor and product id */
 #define XMOS_VID 0x20b1
 
@@ -44,9 +58,23 @@ device_pid_t pidList[] = {
     { "XMOS_U8_MFA_AUDIO2_PID",      0x000A}
 };
 
-unsigned int XMOS_DFU_IF = 0;
+thread_local unsigned int XMOS_DFU_IF = 0;
+thread_local unsigned int dfu_request_if = 0; // wIndex of download requests, XMOS_DFU_IF for a background download
 static int dfu_timeout = 5000; // 5s
 
+// DFU functional descriptor
+#define DFU_FUNCTIONAL_DESC_TYPE      0x21
+#define DFU_FUNCTIONAL_DESC_LENGTH    9
+
+// wTransferSize used if the device does not report one, and the largest supported
+#define DFU_DEFAULT_TRANSFER_SIZE     64
+#define DFU_MAX_TRANSFER_SIZE         4096
+
+// Flash page size, the unit of delta downloads
+#define DFU_FLASH_PAGE_SIZE           256
+
+static thread_local unsigned int dfu_transfer_size = DFU_DEFAULT_TRANSFER_SIZE;
+
 #define USB_BMREQ_H2D_CLASS_INT (LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE)
 #define USB_BMREQ_D2H_CLASS_INT (LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE)
 
@@ -66,6 +94,31 @@ static int dfu_timeout = 5000; // 5s
 #define XMOS_DFU_REVERTFACTORY        0xf1
 #define XMOS_DFU_RESETINTODFU         0xf2
 #define XMOS_DFU_RESETFROMDFU         0xf3
+#define XMOS_DFU_GETPAGEHASHES        0xf5
+#define XMOS_DFU_WRITEPAGES           0xf6
+#define XMOS_DFU_GETFEATURES          0xf7
+#define XMOS_DFU_GETIMAGECRC          0xf8
+#define XMOS_DFU_GETRESUME            0xf9
+#define XMOS_DFU_RESUMEDNLOAD         0xfa
+#define XMOS_DFU_SETIMAGESIZE         0xfb
+#define XMOS_DFU_BACKGROUND           0xfc
+
+// XMOS_DFU_GETFEATURES bits
+#define XMOS_DFU_FEATURE_COMPRESSED   (1 << 1)
+#define XMOS_DFU_FEATURE_RESUME       (1 << 3)
+#define XMOS_DFU_FEATURE_IMAGE_SIZE   (1 << 4)
+
+// Compressed image stream, as decoded by the device
+#define XMOS_DFU_LZ_MAGIC             0x315a4c58
+#define XMOS_DFU_LZ_HEADER_BYTES      8
+#define XMOS_DFU_LZ_WINDOW_BYTES      4096
+#define XMOS_DFU_LZ_MIN_MATCH         3
+#define XMOS_DFU_LZ_MAX_MATCH         (XMOS_DFU_LZ_MIN_MATCH + 15 + 255)
+
+// DFU file suffix, XMOS files extend it with a word of image flags
+#define DFU_SUFFIX_LENGTH             16
+#define DFU_SUFFIX_XMOS_LENGTH        20
+#define DFU_SUFFIX_FLAG_COMPRESSED    (1 << 0)
 
 enum dfu_state {
 	DFU_STATE_appIDLE		= 0,
@@ -81,7 +134,137 @@ enum dfu_state {
 	DFU_STATE_dfuERROR		= 10
 };
 
-static libusb_device_handle *devh = NULL;
+/* Per device state, one device per thread when several are updated at once */
+static thread_local libusb_device_handle *devh = NULL;
+static thread_local const char *dfu_device_name = NULL;
+
+/* A device being updated alongside others */
+typedef struct dfu_target_t
+{
+    char path[32];
+    char serial[128];
+    std::atomic<int> phase;
+    std::atomic<size_t> done;
+    std::atomic<size_t> total;
+    int result;
+    double seconds;
+} dfu_target_t;
+
+enum dfu_phase {
+    DFU_PHASE_DETACH,
+    DFU_PHASE_WAIT,
+    DFU_PHASE_TRANSFER,
+    DFU_PHASE_DONE,
+    DFU_PHASE_FAILED
+};
+
+static thread_local dfu_target_t *dfu_target = NULL;
+
+/* Print a message, prefixed with the device when several are being updated */
+static void dfu_log(FILE *file, const char *format, ...)
+{
+    char message[512];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (dfu_device_name)
+    {
+        fprintf(file, "[%s] %s", dfu_device_name, message);
+    }
+    else
+    {
+        fputs(message, file);
+    }
+}
+
+static void dfu_report_progress(size_t done, size_t total)
+{
+    if (dfu_target)
+    {
+        dfu_target->total = total;
+        dfu_target->done = done;
+    }
+}
+
+/* Returns wTransferSize from the DFU functional descriptor following an interface descriptor */
+static unsigned int get_dfu_transfer_size(const struct libusb_interface_descriptor *inter_desc)
+{
+    const unsigned char *extra = inter_desc->extra;
+    int remaining = inter_desc->extra_length;
+
+    while (remaining >= 2 && extra[0] >= 2 && extra[0] <= remaining)
+    {
+        if (extra[1] == DFU_FUNCTIONAL_DESC_TYPE && extra[0] >= 7)
+        {
+            unsigned int transfer_size = extra[5] | (extra[6] << 8);
+            if (transfer_size == 0)
+                return DFU_DEFAULT_TRANSFER_SIZE;
+            if (transfer_size > DFU_MAX_TRANSFER_SIZE)
+                return DFU_MAX_TRANSFER_SIZE;
+            return transfer_size;
+        }
+        remaining -= extra[0];
+        extra += extra[0];
+    }
+
+    return DFU_DEFAULT_TRANSFER_SIZE;
+}
+
+/* Bus number and port numbers, e.g. 1-4.2, which unlike the device address are
+ * kept when the device re-enumerates in DFU mode */
+static void get_device_path(libusb_device *dev, char *path, size_t size)
+{
+    int n = snprintf(path, size, "%u", libusb_get_bus_number(dev));
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+    uint8_t ports[8];
+    int num_ports = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    for (int i = 0; i < num_ports && n > 0 && (size_t)n < size; i++)
+    {
+        n += snprintf(path + n, size - n, "%c%u", i == 0 ? '-' : '.', ports[i]);
+    }
+#else
+    /* Older libusb has no port numbers, fall back to the address */
+    snprintf(path + n, size - n, ":%u", libusb_get_device_address(dev));
+#endif
+}
+
+/* Open dev as devh, finding its DFU interface and wTransferSize */
+static int open_xmos_device(libusb_device *dev)
+{
+    struct libusb_config_descriptor *config_desc = NULL;
+
+    if (libusb_open(dev, &devh) < 0)
+    {
+        devh = NULL;
+        return -1;
+    }
+
+    if (libusb_get_active_config_descriptor(dev, &config_desc) != 0)
+    {
+        libusb_close(devh);
+        devh = NULL;
+        return -1;
+    }
+
+    XMOS_DFU_IF = 0;
+    if (config_desc != NULL)
+    {
+        for (int j = 0; j < config_desc->bNumInterfaces; j++)
+        {
+            const struct libusb_interface_descriptor *inter_desc = ((struct libusb_interface *)&config_desc->interface[j])->altsetting;
+            if (inter_desc->bInterfaceClass == 0xFE && inter_desc->bInterfaceSubClass == 0x1)
+            {
+                XMOS_DFU_IF = inter_desc->bInterfaceNumber;
+                dfu_transfer_size = get_dfu_transfer_size(inter_desc);
+            }
+        }
+        libusb_free_config_descriptor(config_desc);
+    }
+    return 0;
+}
 
 static int find_xmos_device(unsigned int id, unsigned int pid, unsigned int list)
 {
@@ -90,271 +273,1451 @@ static int find_xmos_device(unsigned int id, unsigned int pid, unsigned int list
     int i = 0;
     unsigned int found = 0;
 
-    size_t count = libusb_get_device_list(NULL, &devs);
-    if ((int)count < 0)
+    size_t count = libusb_get_device_list(NULL, &devs);
+    if ((int)count < 0)
+    {
+        printf("ERROR: get_device_list returned %d\n", (int)count);
+        exit(1);
+    }
+
+    while ((dev = devs[i++]) != NULL)
+    {
+        int foundDev = 0;
+        struct libusb_device_descriptor desc;
+        char path[32];
+        libusb_get_device_descriptor(dev, &desc);
+        get_device_path(dev, path, sizeof(path));
+        printf("VID = 0x%x, PID = 0x%x, BCDDevice: 0x%x, Path: %s\n", desc.idVendor, desc.idProduct, desc.bcdDevice, path);
+
+        if(desc.idVendor == XMOS_VID)
+        {
+            if (desc.idProduct == pid && !list)
+            {
+                foundDev = 1;
+            }
+        }
+
+        if (foundDev)
+        {
+            if (found == id)
+            {
+                open_xmos_device(dev);
+                break;
+            }
+            found++;
+        }
+    }
+
+    libusb_free_device_list(devs, 1);
+
+    return devh ? 0 : -1;
+}
+
+int xmos_dfu_resetdevice(void)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETDEVICE, 0, 0, NULL, 0, 0);
+    return 0;
+}
+
+int xmos_dfu_revertfactory(void)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_VENDOR_INT, XMOS_DFU_REVERTFACTORY, 0, 0, NULL, 0, 0);
+    return 0;
+}
+
+int xmos_dfu_resetintodfu(unsigned int interface)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETINTODFU, 0, interface, NULL, 0, 0);
+    return 0;
+}
+
+int xmos_dfu_resetfromdfu(unsigned int interface)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETFROMDFU, 0, interface, NULL, 0, 0);
+    return 0;
+}
+
+int dfu_detach(unsigned int interface, unsigned int timeout)
+{
+    return libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_DETACH, timeout, interface, NULL, 0, dfu_timeout);
+}
+
+int dfu_getState(unsigned int interface, unsigned char *state)
+{
+    libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATE, 0, interface, state, 1, 0);
+    return 0;
+}
+
+int dfu_getStatus(unsigned int interface, unsigned char *state, unsigned int *timeout,
+                  unsigned char *nextState, unsigned char *strIndex)
+{
+    unsigned int data[2];
+    libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATUS, 0, interface, (unsigned char *)data, 6, 0);
+
+    *state = data[0] & 0xff;
+    *timeout = (data[0] >> 8) & 0xffffff;
+    *nextState = data[1] & 0xff;
+    *strIndex = (data[1] >> 8) & 0xff;
+    return 0;
+}
+
+int dfu_clrStatus(unsigned int interface)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_CLRSTATUS, 0, interface, NULL, 0, 0);
+    return 0;
+}
+
+int dfu_abort(unsigned int interface)
+{
+    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_ABORT, 0, interface, NULL, 0, 0);
+    return 0;
+}
+
+unsigned int dfu_download(unsigned int interface, unsigned int block_num, unsigned int size, unsigned char *data)
+{
+    //dfu_log(stdout, "... Downloading block number %d size %d\r", block_num, size);
+    /* Returns actual data size transferred */
+    unsigned int transfered = libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_DNLOAD, block_num, interface, data, size, 0);
+    return transfered;
+}
+
+int dfu_upload(unsigned int interface, unsigned int block_num, unsigned int size, unsigned char*data)
+{
+    unsigned int numBytes = 0;
+    numBytes = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_UPLOAD, block_num, interface, (unsigned char *)data, size, 0);
+    return numBytes;
+}
+
+/* Nibble tables for the reflected CRC-32 (0xEDB88320) and CRC-32C (0x82F63B78) polynomials, as used by the device */
+static const unsigned int crc32_table[16] =
+{
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static const unsigned int crc32c_table[16] =
+{
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
+
+/* Continue a CRC (initially 0xffffffff, inverted when complete) over length bytes */
+static unsigned int crc_update(unsigned int crc, const unsigned int table[16], const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return crc;
+}
+
+static unsigned int get_le32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+/* Read-only memory mapping of an image file */
+typedef struct mapped_image_t
+{
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} mapped_image_t;
+
+static int map_image(const char *file, mapped_image_t *image)
+{
+    struct stat statbuf;
+
+    memset(image, 0, sizeof(*image));
+
+    if (stat(file, &statbuf) != 0)
+    {
+        dfu_log(stderr, "Error: Failed to open input data file.\n");
+        return -1;
+    }
+    if (S_ISDIR(statbuf.st_mode))
+    {
+        dfu_log(stderr, "Error: Specified path is a directory.\n");
+        return -1;
+    }
+    if (statbuf.st_size == 0)
+    {
+        dfu_log(stderr, "Error: Input data file is empty.\n");
+        return -1;
+    }
+    image->size = (size_t)statbuf.st_size;
+
+#ifdef _WIN32
+    image->file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (image->file == INVALID_HANDLE_VALUE)
+    {
+        dfu_log(stderr, "Error: Failed to open input data file.\n");
+        return -1;
+    }
+    image->mapping = CreateFileMappingA(image->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (image->mapping != NULL)
+    {
+        image->data = (const unsigned char *)MapViewOfFile(image->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (image->data == NULL)
+    {
+        dfu_log(stderr, "Error: Failed to map input data file.\n");
+        if (image->mapping != NULL)
+            CloseHandle(image->mapping);
+        CloseHandle(image->file);
+        return -1;
+    }
+#else
+    image->fd = open(file, O_RDONLY);
+    if (image->fd < 0)
+    {
+        dfu_log(stderr, "Error: Failed to open input data file.\n");
+        return -1;
+    }
+    void *data = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, image->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        dfu_log(stderr, "Error: Failed to map input data file.\n");
+        close(image->fd);
+        return -1;
+    }
+    image->data = (const unsigned char *)data;
+#endif
+    return 0;
+}
+
+static void unmap_image(mapped_image_t *image)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(image->data);
+    CloseHandle(image->mapping);
+    CloseHandle(image->file);
+#else
+    munmap((void *)image->data, image->size);
+    close(image->fd);
+#endif
+}
+
+/* Image to download: a mapped file less any DFU suffix, or a buffer once it is (de)compressed */
+typedef struct dfu_image_t
+{
+    const char *name;
+    mapped_image_t file;
+    const unsigned char *data;
+    size_t size;
+    size_t image_size; /* Size once decompressed */
+    int compressed;
+    std::vector<unsigned char> buffer;
+} dfu_image_t;
+
+static int load_dfu_image(const char *file, unsigned int pid, dfu_image_t *image)
+{
+    unsigned int flags = 0;
+
+    if (map_image(file, &image->file) != 0)
+    {
+        return -1;
+    }
+
+    image->name = file;
+    image->data = image->file.data;
+    image->size = image->file.size;
+
+    if (image->size >= DFU_SUFFIX_LENGTH)
+    {
+        const unsigned char *suffix = image->data + image->size - DFU_SUFFIX_LENGTH;
+
+        if (suffix[8] == 'U' && suffix[9] == 'F' && suffix[10] == 'D')
+        {
+            unsigned int length = suffix[11];
+            unsigned int file_pid = suffix[2] | (suffix[3] << 8);
+            unsigned int file_vid = suffix[4] | (suffix[5] << 8);
+
+            if (length < DFU_SUFFIX_LENGTH || length > image->size ||
+                get_le32(&suffix[12]) != crc_update(0xffffffff, crc32_table, image->data, image->size - 4))
+            {
+                dfu_log(stderr, "Error: DFU suffix of %s is invalid.\n", file);
+                unmap_image(&image->file);
+                return -1;
+            }
+            if ((file_vid != 0xffff && file_vid != XMOS_VID) || (file_pid != 0xffff && file_pid != pid))
+            {
+                dfu_log(stderr, "Error: %s is for device %04x:%04x.\n", file, file_vid, file_pid);
+                unmap_image(&image->file);
+                return -1;
+            }
+            if (file_vid == XMOS_VID && length >= DFU_SUFFIX_XMOS_LENGTH)
+            {
+                flags = get_le32(image->data + image->size - DFU_SUFFIX_XMOS_LENGTH);
+            }
+            image->size -= length;
+        }
+    }
+
+    /* The device recognises a compressed image by the stream header alone */
+    image->compressed = image->size >= XMOS_DFU_LZ_HEADER_BYTES && get_le32(image->data) == XMOS_DFU_LZ_MAGIC;
+    if ((flags & DFU_SUFFIX_FLAG_COMPRESSED) && !image->compressed)
+    {
+        dfu_log(stderr, "Error: %s is not a valid compressed image.\n", file);
+        unmap_image(&image->file);
+        return -1;
+    }
+
+    image->image_size = image->compressed ? get_le32(image->data + 4) : image->size;
+    if (image->image_size == 0)
+    {
+        dfu_log(stderr, "Error: %s contains no image.\n", file);
+        unmap_image(&image->file);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_dfu_image(dfu_image_t *image)
+{
+    unmap_image(&image->file);
+    image->buffer.clear();
+}
+
+static void put_le32(std::vector<unsigned char> &out, unsigned int value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out.push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+static unsigned int lz_hash(const unsigned char *data)
+{
+    return ((data[0] << 16 | data[1] << 8 | data[2]) * 2654435761u) >> 18;
+}
+
+/*
+ * LZSS compressor for the device's stream decoder. Each flag byte describes the
+ * next eight items, LSB first: a set bit is a literal, a clear bit a match of
+ * two bytes, the distance - 1 in 12 bits and a length code in the low nibble of
+ * the second byte. Length code 15 is followed by a byte extending the length.
+ * Matches are found greedily from hash chains over the window.
+ */
+static void lz_compress(const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+{
+    const unsigned int max_chain = 256;
+    std::vector<int> head(1 << 14, -1);
+    std::vector<int> prev(XMOS_DFU_LZ_WINDOW_BYTES, -1);
+    size_t flag_pos = 0;
+    unsigned int flag_bit = 8;
+    size_t pos = 0;
+
+    out.clear();
+    put_le32(out, XMOS_DFU_LZ_MAGIC);
+    put_le32(out, (unsigned int)size);
+
+    while (pos < size)
+    {
+        size_t best_length = 0;
+        size_t best_distance = 0;
+
+        if (flag_bit == 8)
+        {
+            flag_pos = out.size();
+            out.push_back(0);
+            flag_bit = 0;
+        }
+
+        if (pos + XMOS_DFU_LZ_MIN_MATCH <= size)
+        {
+            size_t max_length = size - pos < XMOS_DFU_LZ_MAX_MATCH ? size - pos : XMOS_DFU_LZ_MAX_MATCH;
+            unsigned int chain = max_chain;
+
+            for (int candidate = head[lz_hash(&data[pos])];
+                 candidate >= 0 && pos - candidate <= XMOS_DFU_LZ_WINDOW_BYTES && chain--;
+                 candidate = prev[candidate & (XMOS_DFU_LZ_WINDOW_BYTES - 1)])
+            {
+                size_t length = 0;
+                while (length < max_length && data[candidate + length] == data[pos + length])
+                {
+                    length++;
+                }
+                if (length > best_length)
+                {
+                    best_length = length;
+                    best_distance = pos - candidate;
+                    if (length == max_length)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        size_t advance = 1;
+        if (best_length >= XMOS_DFU_LZ_MIN_MATCH)
+        {
+            unsigned int code = best_length - XMOS_DFU_LZ_MIN_MATCH < 15 ? (unsigned int)(best_length - XMOS_DFU_LZ_MIN_MATCH) : 15;
+            out.push_back((best_distance - 1) & 0xff);
+            out.push_back((((best_distance - 1) >> 8) << 4) | code);
+            if (code == 15)
+            {
+                out.push_back((unsigned char)(best_length - XMOS_DFU_LZ_MIN_MATCH - 15));
+            }
+            advance = best_length;
+        }
+        else
+        {
+            out[flag_pos] |= 1 << flag_bit;
+            out.push_back(data[pos]);
+        }
+        flag_bit++;
+
+        for (size_t end = pos + advance; pos < end; pos++)
+        {
+            if (pos + XMOS_DFU_LZ_MIN_MATCH <= size)
+            {
+                unsigned int h = lz_hash(&data[pos]);
+                prev[pos & (XMOS_DFU_LZ_WINDOW_BYTES - 1)] = head[h];
+                head[h] = (int)pos;
+            }
+        }
+    }
+}
+
+/* Returns 0 if the stream is valid */
+static int lz_decompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+{
+    unsigned int flags = 1;
+    size_t i = XMOS_DFU_LZ_HEADER_BYTES;
+
+    if (size < XMOS_DFU_LZ_HEADER_BYTES || get_le32(data) != XMOS_DFU_LZ_MAGIC)
+    {
+        return -1;
+    }
+
+    size_t image_size = get_le32(data + 4);
+    out.clear();
+    out.reserve(image_size);
+
+    while (out.size() < image_size)
+    {
+        if (flags == 1)
+        {
+            if (i >= size)
+                return -1;
+            flags = data[i++] | 0x100;
+        }
+
+        if (flags & 1)
+        {
+            if (i >= size)
+                return -1;
+            out.push_back(data[i++]);
+        }
+        else
+        {
+            if (i + 2 > size)
+                return -1;
+            size_t distance = (data[i] | ((data[i + 1] >> 4) << 8)) + 1;
+            size_t length = XMOS_DFU_LZ_MIN_MATCH + (data[i + 1] & 0xf);
+            i += 2;
+            if (length == XMOS_DFU_LZ_MIN_MATCH + 15)
+            {
+                if (i >= size)
+                    return -1;
+                length += data[i++];
+            }
+            if (distance > out.size() || out.size() + length > image_size)
+                return -1;
+            for (size_t k = 0; k < length; k++)
+            {
+                unsigned char byte = out[out.size() - distance];
+                out.push_back(byte);
+            }
+        }
+        flags >>= 1;
+    }
+    return 0;
+}
+
+/* Returns non-zero, leaving the image unchanged, if it does not compress */
+static int compress_dfu_image(dfu_image_t *image)
+{
+    std::vector<unsigned char> out;
+
+    lz_compress(image->data, image->size, out);
+    if (out.size() >= image->size)
+    {
+        dfu_log(stdout, "... Image does not compress\n");
+        return -1;
+    }
+    image->buffer.swap(out);
+    image->data = image->buffer.data();
+    image->size = image->buffer.size();
+    image->compressed = 1;
+    dfu_log(stdout, "... Compressed %u byte image to %u bytes\n", (unsigned int)image->image_size, (unsigned int)image->size);
+    return 0;
+}
+
+static int decompress_dfu_image(dfu_image_t *image)
+{
+    std::vector<unsigned char> out;
+
+    if (lz_decompress(image->data, image->size, out) != 0)
+    {
+        dfu_log(stderr, "Error: Compressed image %s is corrupt.\n", image->name);
+        return -1;
+    }
+    image->buffer.swap(out);
+    image->data = image->buffer.data();
+    image->size = image->buffer.size();
+    image->compressed = 0;
+    return 0;
+}
+
+/* Write the image followed by a DFU suffix for the device, flagging it if compressed */
+static int save_dfu_image(const dfu_image_t *image, const char *file, unsigned int pid)
+{
+    std::vector<unsigned char> suffix;
+    FILE *outFile = fopen(file, "wb");
+
+    if (outFile == NULL)
+    {
+        dfu_log(stderr, "Error: Failed to open output data file.\n");
+        return -1;
+    }
+
+    put_le32(suffix, image->compressed ? DFU_SUFFIX_FLAG_COMPRESSED : 0);
+    put_le32(suffix, 0xffff | (pid << 16));      /* bcdDevice, idProduct */
+    put_le32(suffix, XMOS_VID | (0x0100 << 16)); /* idVendor, bcdDFU */
+    put_le32(suffix, 'U' | ('F' << 8) | ('D' << 16) | (DFU_SUFFIX_XMOS_LENGTH << 24));
+
+    /* dwCRC is not inverted, as for dfu-util */
+    unsigned int crc = crc_update(0xffffffff, crc32_table, image->data, image->size);
+    put_le32(suffix, crc_update(crc, crc32_table, suffix.data(), suffix.size()));
+
+    int result = 0;
+    if (fwrite(image->data, 1, image->size, outFile) != image->size ||
+        fwrite(suffix.data(), 1, suffix.size(), outFile) != suffix.size())
+    {
+        dfu_log(stderr, "Error: Failed to write output data file.\n");
+        result = -1;
+    }
+    fclose(outFile);
+    return result;
+}
+
+/* Returns the XMOS_DFU_FEATURE_ bits of the device, 0 if it does not support the request */
+static unsigned int dfu_get_features(void)
+{
+    unsigned char data[4];
+    int r = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, XMOS_DFU_GETFEATURES, 0, dfu_request_if, data, sizeof(data), dfu_timeout);
+    return r == (int)sizeof(data) ? get_le32(data) : 0;
+}
+
+/* Asynchronous control transfer, complete once done is set by the callback */
+typedef struct dfu_transfer_t
+{
+    struct libusb_transfer *transfer;
+    int done;
+    unsigned char buffer[LIBUSB_CONTROL_SETUP_SIZE + DFU_MAX_TRANSFER_SIZE];
+} dfu_transfer_t;
+
+static void LIBUSB_CALL dfu_transfer_cb(struct libusb_transfer *transfer)
+{
+    *(int *)transfer->user_data = 1;
+}
+
+/* Fill in the setup packet, the data of an OUT request is written to dfu_transfer_data() beforehand */
+static void dfu_transfer_setup(dfu_transfer_t *t, unsigned char bmRequestType, unsigned char bRequest,
+                               unsigned short wValue, unsigned short wIndex, unsigned short wLength)
+{
+    libusb_fill_control_setup(t->buffer, bmRequestType, bRequest, wValue, wIndex, wLength);
+    libusb_fill_control_transfer(t->transfer, devh, t->buffer, dfu_transfer_cb, &t->done, dfu_timeout);
+}
+
+static unsigned char *dfu_transfer_data(dfu_transfer_t *t)
+{
+    return t->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+}
+
+static int dfu_transfer_submit(dfu_transfer_t *t)
+{
+    t->done = 0;
+    return libusb_submit_transfer(t->transfer);
+}
+
+/* Returns the number of data bytes transferred or a negative value on error */
+static int dfu_transfer_wait(dfu_transfer_t *t)
+{
+    while (!t->done)
+    {
+        struct timeval tv = {0, 100000};
+#if defined(LIBUSB_API_VERSION)
+        int r = libusb_handle_events_timeout_completed(NULL, &tv, &t->done);
+#else
+        int r = libusb_handle_events_timeout(NULL, &tv);
+#endif
+        if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED)
+        {
+            libusb_cancel_transfer(t->transfer);
+            while (!t->done)
+                libusb_handle_events_timeout(NULL, &tv);
+            return r;
+        }
+    }
+
+    if (t->transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        return -(int)t->transfer->status - 1;
+    }
+    return t->transfer->actual_length;
+}
+
+typedef std::chrono::steady_clock dfu_clock;
+
+static double dfu_seconds(dfu_clock::time_point start, dfu_clock::time_point end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+/* Sleep until the last millisecond before the deadline then spin, so bwPollTimeout is honoured without oversleeping */
+static void dfu_wait_until(dfu_clock::time_point deadline)
+{
+    const dfu_clock::duration spin = std::chrono::milliseconds(1);
+    dfu_clock::time_point now = dfu_clock::now();
+
+    if (deadline - now > spin)
+    {
+        std::this_thread::sleep_for(deadline - now - spin);
+    }
+    while (dfu_clock::now() < deadline)
+    {
+        std::this_thread::yield();
+    }
+}
+
+/* Write block num of the image to a download transfer, returning its length */
+static unsigned int dfu_prepare_block(dfu_transfer_t *t, const dfu_image_t *image, unsigned int block_size, unsigned int num)
+{
+    size_t offset = (size_t)num * block_size;
+    unsigned int length = 0;
+
+    if (offset < image->size)
+    {
+        length = image->size - offset < block_size ? (unsigned int)(image->size - offset) : block_size;
+        memcpy(dfu_transfer_data(t), image->data + offset, length);
+
+        /* Pad a short last block to whole packets, as devices reporting a 64 byte
+         * wTransferSize always consume a full transfer */
+        unsigned int padded = (length + DFU_DEFAULT_TRANSFER_SIZE - 1) / DFU_DEFAULT_TRANSFER_SIZE * DFU_DEFAULT_TRANSFER_SIZE;
+        if (padded > block_size)
+            padded = block_size;
+        memset(dfu_transfer_data(t) + length, 0, padded - length);
+        length = padded;
+    }
+
+    dfu_transfer_setup(t, USB_BMREQ_H2D_CLASS_INT, DFU_DNLOAD, num & 0xffff, dfu_request_if, length);
+    return length;
+}
+
+/*
+ * Download engine. The image is memory mapped and each DFU_DNLOAD is queued
+ * together with the DFU_GETSTATUS that follows it, while the next block is
+ * prepared in a second transfer. The DFU state machine does not allow the next
+ * DFU_DNLOAD until the device reports dfuDNLOAD-IDLE, so while it reports busy
+ * the status is polled again after exactly bwPollTimeout.
+ */
+int write_dfu_image(const dfu_image_t *image)
+{
+    dfu_transfer_t dnload[2];
+    dfu_transfer_t status;
+    unsigned int block_size = dfu_transfer_size;
+    unsigned int busy_polls = 0;
+    int result = 0;
+
+    dnload[0].transfer = libusb_alloc_transfer(0);
+    dnload[1].transfer = libusb_alloc_transfer(0);
+    status.transfer = libusb_alloc_transfer(0);
+    if (!dnload[0].transfer || !dnload[1].transfer || !status.transfer)
+    {
+        dfu_log(stderr, "Error: Failed to allocate USB transfers.\n");
+        result = -1;
+    }
+
+    /* The final zero length block terminates the download */
+    unsigned int num_blocks = (unsigned int)((image->size + block_size - 1) / block_size);
+
+    dfu_log(stdout, "... Downloading %simage (%s) to device, %u byte transfers\n", image->compressed ? "compressed " : "", image->name, block_size);
+
+    dfu_clock::time_point start = dfu_clock::now();
+    dfu_clock::time_point erase_end = start;
+    dfu_clock::time_point program_end = start;
+    unsigned int length = 0;
+
+    if (result == 0)
+    {
+        length = dfu_prepare_block(&dnload[0], image, block_size, 0);
+    }
+
+    for (unsigned int block = 0; result == 0 && block <= num_blocks; block++)
+    {
+        dfu_transfer_t *current = &dnload[block & 1];
+
+        dfu_transfer_setup(&status, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATUS, 0, dfu_request_if, 6);
+        if (dfu_transfer_submit(current) != 0)
+        {
+            dfu_log(stderr, "Error: Failed to submit DFU download of block %u.\n", block);
+            result = -1;
+            break;
+        }
+        if (dfu_transfer_submit(&status) != 0)
+        {
+            dfu_log(stderr, "Error: Failed to submit dfu_getStatus().\n");
+            dfu_transfer_wait(current);
+            result = -1;
+            break;
+        }
+
+        /* Prepare the next block while this one is in flight */
+        unsigned int next_length = 0;
+        if (block < num_blocks)
+        {
+            next_length = dfu_prepare_block(&dnload[(block + 1) & 1], image, block_size, block + 1);
+        }
+
+        int transferred = dfu_transfer_wait(current);
+        if (transferred != (int)length)
+        {
+            dfu_log(stderr, "Error: DFU download of block %u failed (%d).\n", block, transferred);
+            dfu_transfer_wait(&status);
+            result = -1;
+            break;
+        }
+
+        while (1)
+        {
+            int r = dfu_transfer_wait(&status);
+            dfu_clock::time_point status_time = dfu_clock::now();
+            if (r != 6)
+            {
+                dfu_log(stderr, "Error: dfu_getStatus() failed (%d).\n", r);
+                result = -1;
+                break;
+            }
+
+            unsigned char *data = dfu_transfer_data(&status);
+            unsigned int bStatus = data[0];
+            unsigned int bwPollTimeout = data[1] | (data[2] << 8) | (data[3] << 16);
+            unsigned int bState = data[4];
+
+            if (bState == DFU_STATE_dfuERROR)
+            {
+                dfu_log(stderr, "Error: dfu_getStatus() returned state as DFU_STATE_dfuERROR (status %u) at block %u.\n", bStatus, block);
+                result = -1;
+                break;
+            }
+            if ((block < num_blocks && bState == DFU_STATE_dfuDNLOAD_IDLE) ||
+                (block == num_blocks && bState == DFU_STATE_dfuIDLE))
+            {
+                break;
+            }
+
+            /* Still busy, poll again once bwPollTimeout has elapsed */
+            busy_polls++;
+            dfu_wait_until(status_time + std::chrono::milliseconds(bwPollTimeout));
+            dfu_transfer_setup(&status, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATUS, 0, dfu_request_if, 6);
+            if (dfu_transfer_submit(&status) != 0)
+            {
+                dfu_log(stderr, "Error: Failed to submit dfu_getStatus().\n");
+                result = -1;
+                break;
+            }
+        }
+
+        dfu_report_progress(std::min((size_t)(block + 1) * block_size, image->size), image->size);
+
+        /* Block 0 includes the erase of the upgrade image */
+        if (block == 0)
+        {
+            erase_end = dfu_clock::now();
+        }
+        if (block + 1 == num_blocks)
+        {
+            program_end = dfu_clock::now();
+        }
+        length = next_length;
+    }
+
+    dfu_clock::time_point end = dfu_clock::now();
+
+    if (result == 0)
+    {
+        double total = dfu_seconds(start, end);
+        double program = dfu_seconds(erase_end, program_end);
+        dfu_log(stdout, "... Download complete: %u bytes in %.2f s (%.1f KiB/s)\n",
+               (unsigned int)image->size, total, total > 0 ? image->size / total / 1024 : 0.0);
+        if (image->compressed)
+        {
+            dfu_log(stdout, "... %u byte image, %.1f KiB/s after decompression\n",
+                   (unsigned int)image->image_size, total > 0 ? image->image_size / total / 1024 : 0.0);
+        }
+        dfu_log(stdout, "... Erase %.3f s, program %.3f s (%.3f ms/block), manifest %.3f s, %u busy polls\n",
+               dfu_seconds(start, erase_end), program,
+               num_blocks > 1 ? program * 1000 / (num_blocks - 1) : 0.0,
+               dfu_seconds(program_end, end), busy_polls);
+    }
+
+    libusb_free_transfer(dnload[0].transfer);
+    libusb_free_transfer(dnload[1].transfer);
+    libusb_free_transfer(status.transfer);
+
+    return result;
+}
+
+/* Fetch the CRC-32 and CRC-32C of every page of the device's upgrade image.
+ * Returns the number of pages, or -1 if the device does not support the request */
+static int dfu_get_page_hashes(std::vector<unsigned int> &hashes)
+{
+    unsigned char data[DFU_MAX_TRANSFER_SIZE];
+    unsigned int first_page = 0;
+    unsigned int num_pages = 0;
+
+    hashes.clear();
+    do
+    {
+        int r = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, XMOS_DFU_GETPAGEHASHES, first_page, dfu_request_if,
+                                        data, dfu_transfer_size, dfu_timeout);
+        if (r < 4)
+        {
+            return -1;
+        }
+
+        num_pages = get_le32(data);
+        unsigned int count = (r - 4) / 8;
+        for (unsigned int i = 0; i < 2 * count; i++)
+        {
+            hashes.push_back(get_le32(&data[4 + 4 * i]));
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        first_page += count;
+    } while (first_page < num_pages);
+
+    if (first_page < num_pages)
+    {
+        return -1;
+    }
+    return (int)num_pages;
+}
+
+/* Page num of the image, with the last page padded with zeros as for a full download */
+static void get_image_page(const dfu_image_t *image, unsigned int num, unsigned char page[DFU_FLASH_PAGE_SIZE])
+{
+    size_t offset = (size_t)num * DFU_FLASH_PAGE_SIZE;
+    size_t length = image->size - offset < DFU_FLASH_PAGE_SIZE ? image->size - offset : DFU_FLASH_PAGE_SIZE;
+
+    memcpy(page, image->data + offset, length);
+    memset(page + length, 0, DFU_FLASH_PAGE_SIZE - length);
+}
+
+/* Returns 0 if the device's upgrade image matches the image */
+static int dfu_check_page_hashes(const dfu_image_t *image, unsigned int num_pages)
+{
+    std::vector<unsigned int> hashes;
+    unsigned char page[DFU_FLASH_PAGE_SIZE];
+
+    if (dfu_get_page_hashes(hashes) < (int)num_pages)
+    {
+        return -1;
+    }
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        get_image_page(image, i, page);
+        if (hashes[2 * i] != ~crc_update(0xffffffff, crc32_table, page, DFU_FLASH_PAGE_SIZE) ||
+            hashes[2 * i + 1] != ~crc_update(0xffffffff, crc32c_table, page, DFU_FLASH_PAGE_SIZE))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Delta download. The device reports a hash of each page of its current upgrade
+ * image and only the pages which differ from the new image are sent, with their
+ * page number, to be programmed in place. Falls back to a full download when the
+ * device does not support this, has no upgrade image or most pages have changed.
+ */
+int write_dfu_image_delta(const dfu_image_t *image)
+{
+    std::vector<unsigned int> hashes;
+    std::vector<unsigned int> changed;
+    unsigned char data[DFU_MAX_TRANSFER_SIZE];
+    int result = 0;
+
+    unsigned int num_pages = (unsigned int)((image->size + DFU_FLASH_PAGE_SIZE - 1) / DFU_FLASH_PAGE_SIZE);
+    unsigned int pages_per_transfer = dfu_transfer_size / DFU_FLASH_PAGE_SIZE;
+    int old_pages = pages_per_transfer ? dfu_get_page_hashes(hashes) : -1;
+
+    if (old_pages <= 0 || num_pages > 0x10000)
+    {
+        dfu_log(stdout, "... Delta download not possible, device %s\n",
+               old_pages < 0 ? "does not support it" : "has no upgrade image");
+        return write_dfu_image(image);
+    }
+
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        unsigned char page[DFU_FLASH_PAGE_SIZE];
+        get_image_page(image, i, page);
+        if (i >= (unsigned int)old_pages ||
+            hashes[2 * i] != ~crc_update(0xffffffff, crc32_table, page, DFU_FLASH_PAGE_SIZE) ||
+            hashes[2 * i + 1] != ~crc_update(0xffffffff, crc32c_table, page, DFU_FLASH_PAGE_SIZE))
+        {
+            changed.push_back(i);
+        }
+    }
+
+    dfu_log(stdout, "... %u of %u pages changed\n", (unsigned int)changed.size(), num_pages);
+
+    if (changed.size() * 2 > num_pages)
+    {
+        dfu_log(stdout, "... Most of the image has changed, downloading the whole image\n");
+        return write_dfu_image(image);
+    }
+
+    dfu_clock::time_point start = dfu_clock::now();
+
+    /* Send runs of consecutive changed pages, up to a transfer at a time */
+    for (size_t i = 0; i < changed.size() && result == 0; )
+    {
+        unsigned int first_page = changed[i];
+        unsigned int count = 0;
+
+        while (i < changed.size() && changed[i] == first_page + count && count < pages_per_transfer)
+        {
+            get_image_page(image, changed[i], &data[count * DFU_FLASH_PAGE_SIZE]);
+            count++;
+            i++;
+        }
+
+        int r = libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_WRITEPAGES, first_page, dfu_request_if,
+                                        data, count * DFU_FLASH_PAGE_SIZE, dfu_timeout);
+        dfu_report_progress(i, changed.size());
+        if (r != (int)(count * DFU_FLASH_PAGE_SIZE))
+        {
+            dfu_log(stderr, "Error: Failed to write pages %u to %u (%d).\n", first_page, first_page + count - 1, r);
+            result = -1;
+        }
+    }
+
+    /* Program the last pending sector */
+    if (result == 0 && libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_WRITEPAGES, 0, dfu_request_if,
+                                               NULL, 0, dfu_timeout) != 0)
+    {
+        dfu_log(stderr, "Error: Failed to write pages.\n");
+        result = -1;
+    }
+
+    if (result == 0 && dfu_check_page_hashes(image, num_pages) != 0)
+    {
+        dfu_log(stderr, "Error: Upgrade image does not match after delta download.\n");
+        result = -1;
+    }
+
+    if (result == 0)
+    {
+        dfu_log(stdout, "... Delta download complete: %u bytes sent in %.2f s\n",
+               (unsigned int)(changed.size() * DFU_FLASH_PAGE_SIZE), dfu_seconds(start, dfu_clock::now()));
+    }
+
+    return result;
+}
+
+/*
+ * Check the device's upgrade image against the image, from the CRC-32 and
+ * CRC-32C the device computes over the pages of its image, rather than
+ * uploading the whole image. Returns 0 if they match.
+ */
+int verify_dfu_image(const dfu_image_t *image)
+{
+    unsigned char data[12];
+    unsigned char page[DFU_FLASH_PAGE_SIZE];
+    unsigned int num_pages = (unsigned int)((image->size + DFU_FLASH_PAGE_SIZE - 1) / DFU_FLASH_PAGE_SIZE);
+    unsigned int crc32 = 0xffffffff;
+    unsigned int crc32c = 0xffffffff;
+
+    dfu_log(stdout, "... Verifying upgrade image against %s\n", image->name);
+
+    dfu_clock::time_point start = dfu_clock::now();
+    int r = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, XMOS_DFU_GETIMAGECRC, 0, dfu_request_if,
+                                    data, sizeof(data), dfu_timeout);
+    if (r != (int)sizeof(data))
+    {
+        dfu_log(stderr, "Error: Device does not support image verification (%d).\n", r);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < num_pages; i++)
+    {
+        get_image_page(image, i, page);
+        crc32 = crc_update(crc32, crc32_table, page, DFU_FLASH_PAGE_SIZE);
+        crc32c = crc_update(crc32c, crc32c_table, page, DFU_FLASH_PAGE_SIZE);
+    }
+
+    unsigned int device_pages = get_le32(data);
+    if (device_pages == 0)
+    {
+        dfu_log(stderr, "Error: Device has no upgrade image.\n");
+        return -1;
+    }
+    if (device_pages != num_pages || get_le32(&data[4]) != ~crc32 || get_le32(&data[8]) != ~crc32c)
+    {
+        dfu_log(stderr, "Error: Upgrade image does not match (%u pages, CRC-32 0x%08x, expected %u pages, CRC-32 0x%08x).\n",
+                device_pages, get_le32(&data[4]), num_pages, ~crc32);
+        return -1;
+    }
+
+    dfu_log(stdout, "... Upgrade image matches: %u pages, CRC-32 0x%08x, checked in %.2f s\n",
+           num_pages, ~crc32, dfu_seconds(start, dfu_clock::now()));
+    return 0;
+}
+
+/*
+ * Resume an interrupted download. The device reports how many pages the last
+ * download programmed, and their CRCs. If these match the start of the image the
+ * download continues from the next page, rather than erasing the upgrade image
+ * and starting again. Returns the page the download continues from, 0 if the
+ * whole image must be downloaded.
+ */
+static unsigned int dfu_resume_download(const dfu_image_t *image)
+{
+    unsigned char data[12];
+    unsigned char page[DFU_FLASH_PAGE_SIZE];
+    std::vector<unsigned char> plain;
+    dfu_image_t plain_image = dfu_image_t();
+    unsigned int crc32 = 0xffffffff;
+    unsigned int crc32c = 0xffffffff;
+
+    int r = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, XMOS_DFU_GETRESUME, 0, dfu_request_if,
+                                    data, sizeof(data), dfu_timeout);
+    unsigned int pages = r == (int)sizeof(data) ? get_le32(data) : 0;
+    if (pages == 0)
+    {
+        return 0;
+    }
+
+    /* The device programs the image uncompressed */
+    if (image->compressed)
+    {
+        if (lz_decompress(image->data, image->size, plain) != 0)
+        {
+            return 0;
+        }
+        plain_image.data = plain.data();
+        plain_image.size = plain.size();
+        image = &plain_image;
+    }
+
+    unsigned int num_pages = (unsigned int)((image->size + DFU_FLASH_PAGE_SIZE - 1) / DFU_FLASH_PAGE_SIZE);
+    if (pages > num_pages || pages > 0xffff)
+    {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < pages; i++)
+    {
+        get_image_page(image, i, page);
+        crc32 = crc_update(crc32, crc32_table, page, DFU_FLASH_PAGE_SIZE);
+        crc32c = crc_update(crc32c, crc32c_table, page, DFU_FLASH_PAGE_SIZE);
+    }
+    if (get_le32(&data[4]) != ~crc32 || get_le32(&data[8]) != ~crc32c)
+    {
+        return 0;
+    }
+
+    if (libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESUMEDNLOAD, pages, dfu_request_if,
+                                NULL, 0, dfu_timeout) != 0)
+    {
+        dfu_log(stdout, "... Device could not resume the download\n");
+        return 0;
+    }
+
+    dfu_log(stdout, "... %u of %u pages already programmed, resuming download\n", pages, num_pages);
+    return pages;
+}
+
+/* Tell the device the size of the image it will program, so it only erases that much flash */
+static int dfu_set_image_size(const dfu_image_t *image)
+{
+    std::vector<unsigned char> data;
+
+    put_le32(data, (unsigned int)image->image_size);
+    if (libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_SETIMAGESIZE, 0, dfu_request_if,
+                                data.data(), (uint16_t)data.size(), dfu_timeout) != (int)data.size())
+    {
+        dfu_log(stderr, "Error: Image of %u bytes is too large for the device\n", (unsigned int)image->image_size);
+        return -1;
+    }
+    return 0;
+}
+
+/* Download or verify an image once the device is in DFU mode, returns 0 on success */
+static int dfu_mode_command(dfu_image_t *image, unsigned int delta, unsigned int compress, unsigned int verify)
+{
+    int result = 0;
+
+    if (verify)
     {
-        printf("ERROR: get_device_list returned %d\n", (int)count);
-        exit(1);
+        if ((image->compressed && decompress_dfu_image(image) != 0) || verify_dfu_image(image) != 0)
+        {
+            return -1;
+        }
+        return 0;
     }
 
-    while ((dev = devs[i++]) != NULL)
-    {
-        int foundDev = 0;
-        struct libusb_device_descriptor desc;
-        libusb_get_device_descriptor(dev, &desc);
-        printf("VID = 0x%x, PID = 0x%x, BCDDevice: 0x%x\n", desc.idVendor, desc.idProduct, desc.bcdDevice);
+    unsigned int features = dfu_get_features();
 
-        if(desc.idVendor == XMOS_VID)
+    /* Delta downloads compare uncompressed pages */
+    if (image->compressed && (delta || !(features & XMOS_DFU_FEATURE_COMPRESSED)))
+    {
+        if (!delta)
         {
-            if (desc.idProduct == pid && !list)
-            {
-                foundDev = 1;
-            }
+            dfu_log(stdout, "... Device does not support compressed images, decompressing\n");
         }
-
-        if (foundDev)
+        result = decompress_dfu_image(image);
+    }
+    else if (compress && !image->compressed)
+    {
+        if (features & XMOS_DFU_FEATURE_COMPRESSED)
         {
-            if (found == id)
-            {
-                if (libusb_open(dev, &devh) < 0)
-                {
-                    return -1;
-                }
-                else
-                {
-                    struct libusb_config_descriptor *config_desc = NULL;
-                    int ret = libusb_get_active_config_descriptor(dev, &config_desc);
-                    if (ret != 0) {
-                      return -1;
-                    }
-                    if (config_desc != NULL)
-                    {
-                        //printf("bNumInterfaces: %d\n", config_desc->bNumInterfaces);
-                        for (int j = 0; j < config_desc->bNumInterfaces; j++)
-                        {
-                            //printf("%d\n", j);
-                            const struct libusb_interface_descriptor *inter_desc = ((struct libusb_interface *)&config_desc->interface[j])->altsetting;
-                            if (inter_desc->bInterfaceClass == 0xFE && inter_desc->bInterfaceSubClass == 0x1)
-                            {
-                                XMOS_DFU_IF = inter_desc->bInterfaceNumber;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        XMOS_DFU_IF = 0;
-                    }
-                }
-                break;
-            }
-            found++;
+            compress_dfu_image(image);
+        }
+        else
+        {
+            dfu_log(stdout, "... Device does not support compressed images\n");
         }
     }
 
-    libusb_free_device_list(devs, 1);
+    if (result == 0 && !delta && (features & XMOS_DFU_FEATURE_IMAGE_SIZE))
+    {
+        result = dfu_set_image_size(image);
+    }
 
-    return devh ? 0 : -1;
-}
+    unsigned int resume_page = 0;
+    if (result == 0 && !delta && (features & XMOS_DFU_FEATURE_RESUME))
+    {
+        /* The rest of a resumed download follows uncompressed */
+        resume_page = dfu_resume_download(image);
+        if (resume_page && image->compressed)
+        {
+            result = decompress_dfu_image(image);
+        }
+    }
 
-int xmos_dfu_resetdevice(void)
-{
-    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETDEVICE, 0, 0, NULL, 0, 0);
-    return 0;
-}
+    if (result == 0 && resume_page)
+    {
+        dfu_image_t remaining = dfu_image_t();
+        size_t offset = std::min((size_t)resume_page * DFU_FLASH_PAGE_SIZE, image->size);
+
+        remaining.name = image->name;
+        remaining.data = image->data + offset;
+        remaining.size = image->size - offset;
+        remaining.image_size = remaining.size;
+        result = write_dfu_image(&remaining);
+    }
+    else if (result == 0)
+    {
+        result = delta ? write_dfu_image_delta(image) : write_dfu_image(image);
+    }
 
-int xmos_dfu_revertfactory(void)
-{
-    libusb_control_transfer(devh, USB_BMREQ_H2D_VENDOR_INT, XMOS_DFU_REVERTFACTORY, 0, 0, NULL, 0, 0);
-    return 0;
+    if (result != 0)
+    {
+        dfu_log(stderr, "Error: Download failed\n");
+        result = -1;
+    }
+    return result;
 }
 
-int xmos_dfu_resetintodfu(unsigned int interface)
+/*
+ * Download an image while the device stays in application mode and keeps
+ * streaming audio. Requests go to the DFU interface of the application, and the
+ * device paces programming with bwPollTimeout. It boots the image after its
+ * next reset.
+ */
+static int background_download(dfu_image_t *image, unsigned int compress)
 {
-    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETINTODFU, 0, interface, NULL, 0, 0);
-    return 0;
-}
+    dfu_request_if = XMOS_DFU_IF;
+    if (libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_BACKGROUND, 0, dfu_request_if,
+                                NULL, 0, dfu_timeout) != 0)
+    {
+        dfu_log(stderr, "Error: Device does not support background downloads\n");
+        return -1;
+    }
 
-int xmos_dfu_resetfromdfu(unsigned int interface)
-{
-    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, XMOS_DFU_RESETFROMDFU, 0, interface, NULL, 0, 0);
+    dfu_log(stdout, "... Downloading in the background, audio continues\n");
+    if (dfu_mode_command(image, 0, compress, 0) != 0)
+    {
+        return -1;
+    }
+    dfu_log(stdout, "... Image staged, the device boots it after its next reset\n");
     return 0;
 }
 
-int dfu_detach(unsigned int interface, unsigned int timeout)
+/* Returns non-zero if the device only has a DFU interface in DFU mode (bInterfaceProtocol 2) */
+static int in_dfu_mode(libusb_device *dev)
 {
-    return libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_DETACH, timeout, interface, NULL, 0, dfu_timeout);
-}
+    struct libusb_config_descriptor *config_desc = NULL;
+    int dfu_mode = 0;
 
-int dfu_getState(unsigned int interface, unsigned char *state)
-{
-    libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATE, 0, interface, state, 1, 0);
-    return 0;
+    if (libusb_get_active_config_descriptor(dev, &config_desc) != 0 || config_desc == NULL)
+    {
+        return 0;
+    }
+    for (int j = 0; j < config_desc->bNumInterfaces; j++)
+    {
+        const struct libusb_interface_descriptor *inter_desc = config_desc->interface[j].altsetting;
+        if (inter_desc->bInterfaceClass == 0xFE && inter_desc->bInterfaceSubClass == 0x1 && inter_desc->bInterfaceProtocol == 2)
+        {
+            dfu_mode = 1;
+        }
+    }
+    libusb_free_config_descriptor(config_desc);
+    return dfu_mode;
 }
 
-int dfu_getStatus(unsigned int interface, unsigned char *state, unsigned int *timeout,
-                  unsigned char *nextState, unsigned char *strIndex)
+/* Open the device with the PID at path, in DFU mode or not, as devh */
+static int open_device_at(unsigned int pid, const char *path, int dfu_mode)
 {
-    unsigned int data[2];
-    libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_GETSTATUS, 0, interface, (unsigned char *)data, 6, 0);
-
-    *state = data[0] & 0xff;
-    *timeout = (data[0] >> 8) & 0xffffff;
-    *nextState = data[1] & 0xff;
-    *strIndex = (data[1] >> 8) & 0xff;
-    return 0;
-}
+    libusb_device **devs;
+    ssize_t count = libusb_get_device_list(NULL, &devs);
 
-int dfu_clrStatus(unsigned int interface)
-{
-    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_CLRSTATUS, 0, interface, NULL, 0, 0);
-    return 0;
-}
+    if (count < 0)
+    {
+        return -1;
+    }
 
-int dfu_abort(unsigned int interface)
-{
-    libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_ABORT, 0, interface, NULL, 0, 0);
-    return 0;
-}
+    for (ssize_t i = 0; i < count && devh == NULL; i++)
+    {
+        struct libusb_device_descriptor desc;
+        char dev_path[32];
 
-unsigned int dfu_download(unsigned int interface, unsigned int block_num, unsigned int size, unsigned char *data)
-{
-    //printf("... Downloading block number %d size %d\r", block_num, size);
-    /* Returns actual data size transferred */
-    unsigned int transfered = libusb_control_transfer(devh, USB_BMREQ_H2D_CLASS_INT, DFU_DNLOAD, block_num, interface, data, size, 0);
-    return transfered;
-}
+        libusb_get_device_descriptor(devs[i], &desc);
+        get_device_path(devs[i], dev_path, sizeof(dev_path));
+        if (desc.idVendor == XMOS_VID && desc.idProduct == pid && strcmp(dev_path, path) == 0 &&
+            in_dfu_mode(devs[i]) == dfu_mode)
+        {
+            open_xmos_device(devs[i]);
+        }
+    }
 
-int dfu_upload(unsigned int interface, unsigned int block_num, unsigned int size, unsigned char*data)
-{
-    unsigned int numBytes = 0;
-    numBytes = libusb_control_transfer(devh, USB_BMREQ_D2H_CLASS_INT, DFU_UPLOAD, block_num, interface, (unsigned char *)data, size, 0);
-    return numBytes;
+    libusb_free_device_list(devs, 1);
+    return devh ? 0 : -1;
 }
 
-int write_dfu_image(char *file)
+/* Run the whole detach, DFU command, reset sequence for one device, on its own thread */
+static void update_device(dfu_target_t *target, unsigned int pid, const dfu_image_t *shared_image,
+                          unsigned int delta, unsigned int compress, unsigned int verify)
 {
-    unsigned int i = 0;
-    FILE* inFile = NULL;
-    int image_size = 0;
-    unsigned int num_blocks = 0;
-    unsigned int block_size = 64;
-    unsigned int remainder = 0;
-    unsigned char block_data[256];
+    /* A copy which may be (de)compressed for this device, sharing the mapped file */
+    dfu_image_t image = *shared_image;
+    dfu_clock::time_point start = dfu_clock::now();
+    int result = -1;
 
-    unsigned char dfuState = 0;
-    unsigned char nextDfuState = 0;
-    unsigned int timeout = 0;
-    unsigned char strIndex = 0;
-    unsigned int dfuBlockCount = 0;
-    struct stat statbuf;
+    dfu_device_name = target->path;
+    dfu_target = target;
 
-    inFile = fopen( file, "rb" );
-    if( inFile == NULL )
+    if (open_device_at(pid, target->path, 0) == 0)
     {
-        fprintf(stderr,"Error: Failed to open input data file.\n");
-        return -1;
+        if (libusb_claim_interface(devh, XMOS_DFU_IF) == 0 && dfu_detach(XMOS_DFU_IF, 1000) >= 0)
+        {
+            libusb_release_interface(devh, XMOS_DFU_IF);
+            libusb_close(devh);
+            devh = NULL;
+
+            /* Poll for the device to restart in DFU mode */
+            target->phase = DFU_PHASE_WAIT;
+            dfu_clock::time_point deadline = dfu_clock::now() + std::chrono::seconds(30);
+            while (open_device_at(pid, target->path, 1) != 0 && dfu_clock::now() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            }
+        }
+        else
+        {
+            dfu_log(stderr, "Error: Failed to detach device\n");
+            libusb_close(devh);
+            devh = NULL;
+        }
     }
 
-    /* Check if file is a directory */
-    int status = fstat(fileno(inFile), &statbuf);
-    if (status != 0)
+    if (devh == NULL)
     {
-        fprintf(stderr,"Error: Failed to get info on file.\n");
-        return -1;
+        dfu_log(stderr, "Error: Could not find/open device in DFU mode\n");
     }
-    if ( S_ISDIR(statbuf.st_mode) )
+    else if (libusb_claim_interface(devh, 0) != 0)
     {
-        fprintf(stderr,"Error: Specified path is a directory.\n");
-        return -1;
+        dfu_log(stderr, "Error: Failed to claim interface 0\n");
+    }
+    else
+    {
+        target->phase = DFU_PHASE_TRANSFER;
+        result = dfu_mode_command(&image, delta, compress, verify);
+        if (dfu_detach(XMOS_DFU_IF, 1000) < 0)
+        {
+            dfu_log(stderr, "Error: Failed to return device to application mode\n");
+            result = -1;
+        }
+        libusb_release_interface(devh, 0);
     }
 
-    /* Discover the size of the image. */
-    if( 0 != fseek( inFile, 0, SEEK_END ) )
+    if (devh)
     {
-        fprintf(stderr,"Error: Failed to discover input data file size.\n");
-        return -1;
+        libusb_close(devh);
+        devh = NULL;
     }
 
-    image_size = (int)ftell( inFile );
+    target->result = result;
+    target->seconds = dfu_seconds(start, dfu_clock::now());
+    target->phase = result == 0 ? DFU_PHASE_DONE : DFU_PHASE_FAILED;
+}
+
+/*
+ * Update every device with the PID, optionally only those with a serial number
+ * or at a bus path, concurrently. Each device runs on its own thread, with its
+ * transfers submitted asynchronously to the shared libusb context.
+ */
+static int update_devices(unsigned int pid, const char *serial_filter, const char *path_filter,
+                          const dfu_image_t *image, unsigned int delta, unsigned int compress, unsigned int verify)
+{
+    std::vector<std::unique_ptr<dfu_target_t> > targets;
+    std::vector<std::thread> threads;
+    libusb_device **devs;
+    ssize_t count = libusb_get_device_list(NULL, &devs);
 
-    if( 0 != fseek( inFile, 0, SEEK_SET ) )
+    for (ssize_t i = 0; i < count; i++)
     {
-        fprintf(stderr,"Error: Failed to input file pointer.\n");
-        return -1;
-    }
+        struct libusb_device_descriptor desc;
+        libusb_device_handle *handle;
+
+        libusb_get_device_descriptor(devs[i], &desc);
+        if (desc.idVendor != XMOS_VID || desc.idProduct != pid || libusb_open(devs[i], &handle) != 0)
+        {
+            continue;
+        }
 
-    num_blocks = image_size/block_size;
-    remainder = image_size - (num_blocks * block_size);
+        std::unique_ptr<dfu_target_t> target(new dfu_target_t());
+        get_device_path(devs[i], target->path, sizeof(target->path));
+        if (desc.iSerialNumber == 0 ||
+            libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, (unsigned char *)target->serial, sizeof(target->serial)) < 0)
+        {
+            target->serial[0] = '\0';
+        }
+        libusb_close(handle);
+
+        if ((serial_filter && strcmp(serial_filter, target->serial) != 0) ||
+            (path_filter && strcmp(path_filter, target->path) != 0))
+        {
+            continue;
+        }
+        target->phase = DFU_PHASE_DETACH;
+        targets.push_back(std::move(target));
+    }
+    if (count >= 0)
+    {
+        libusb_free_device_list(devs, 1);
+    }
 
-    printf("... Downloading image (%s) to device\n", file);
+    if (targets.empty())
+    {
+        fprintf(stderr, "Could not find any matching device\n");
+        return -1;
+    }
 
-    dfuBlockCount = 0;
+    printf("Updating %u devices\n", (unsigned int)targets.size());
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        threads.push_back(std::thread(update_device, targets[i].get(), pid, image, delta, compress, verify));
+    }
 
-    for (i = 0; i < num_blocks; i++)
+    /* Report progress until every device has finished */
+    for (size_t finished = 0; finished < targets.size(); )
     {
-        memset(block_data, 0x0, block_size);
-        fread(block_data, 1, block_size, inFile);
-        unsigned int transferred = dfu_download(0, dfuBlockCount, block_size, block_data);
-        if(transferred != block_size)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        std::string line = "Progress:";
+        finished = 0;
+        for (size_t i = 0; i < targets.size(); i++)
         {
-            /* Error */
-            printf("ERROR: %d\n", transferred);
-            return -1;
+            dfu_target_t *t = targets[i].get();
+            char status[64];
+            size_t total = t->total;
 
-        }
-        do {
-            dfu_getStatus(0, &dfuState, &timeout, &nextDfuState, &strIndex);
-            if(nextDfuState == DFU_STATE_dfuERROR)
+            switch (t->phase)
             {
-                fprintf(stderr,"Error: dfu_getStatus() returned state as DFU_STATE_dfuERROR.\n");
-                return -1;
-            }
-            if(nextDfuState == DFU_STATE_dfuDNLOAD_IDLE)
-            {
-                dfuBlockCount++;
-                break;
+                case DFU_PHASE_DETACH: snprintf(status, sizeof(status), "detaching"); break;
+                case DFU_PHASE_WAIT: snprintf(status, sizeof(status), "waiting"); break;
+                case DFU_PHASE_TRANSFER:
+                    snprintf(status, sizeof(status), "%u%%", total ? (unsigned int)(t->done * 100 / total) : 0);
+                    break;
+                case DFU_PHASE_DONE: snprintf(status, sizeof(status), "done"); finished++; break;
+                default: snprintf(status, sizeof(status), "FAILED"); finished++; break;
             }
-            Sleep(timeout);
-        }while(1);
+            line += std::string(" [") + t->path + "] " + status;
+        }
+        printf("%s\n", line.c_str());
+        fflush(stdout);
     }
 
-    if (remainder)
+    for (size_t i = 0; i < threads.size(); i++)
     {
-        memset(block_data, 0x0, block_size);
-        fread(block_data, 1, remainder, inFile);
-        dfu_download(0, dfuBlockCount, block_size, block_data);
-        dfu_getStatus(0, &dfuState, &timeout, &nextDfuState, &strIndex);
+        threads[i].join();
     }
 
-    // 0 length download terminates
-    dfu_download(0, 0, 0, NULL);
-    dfu_getStatus(0, &dfuState, &timeout, &nextDfuState, &strIndex);
-
-    printf("... Download complete\n");
-
-    return 0;
+    unsigned int succeeded = 0;
+    printf("Summary:\n");
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        dfu_target_t *t = targets[i].get();
+        printf("  %-16s %-20s %-6s %6.1f s\n", t->path, t->serial[0] ? t->serial : "-",
+               t->result == 0 ? "OK" : "FAILED", t->seconds);
+        if (t->result == 0)
+        {
+            succeeded++;
+        }
     }
+    printf("%u of %u devices %s\n", succeeded, (unsigned int)targets.size(), verify ? "verified" : "updated");
+
+    return succeeded == targets.size() ? 0 : -1;
+}
 
 int read_dfu_image(char *file)
 {
     FILE *outFile = NULL;
     unsigned int block_count = 0;
-    unsigned int block_size = 64;
-    unsigned char block_data[64];
+    unsigned int block_size = dfu_transfer_size;
+    unsigned char block_data[DFU_MAX_TRANSFER_SIZE];
 
     outFile = fopen( file, "wb" );
     if( outFile == NULL )
     {
-        fprintf(stderr,"Error: Failed to open output data file.\n");
+        dfu_log(stderr, "Error: Failed to open output data file.\n");
         return -1;
     }
 
-    printf("... Uploading image (%s) from device\n", file);
+    dfu_log(stdout, "... Uploading image (%s) from device, %u byte transfers\n", file, block_size);
 
     while (1)
     {
-        unsigned int numBytes = 0;
-        numBytes = dfu_upload(0, block_count, 64, block_data);
+        int numBytes = 0;
+        numBytes = dfu_upload(0, block_count, block_size, block_data);
         /* Upload is completed when dfu_upload() returns an empty block */
         if (numBytes == 0)
         {
@@ -362,7 +1725,7 @@ int read_dfu_image(char *file)
                issue a warning about the upgrade image
             */
             if (block_count==0) {
-                printf("... WARNING: Upgrade image size is 0: check if image is present in the flash\n");
+                dfu_log(stdout, "... WARNING: Upgrade image size is 0: check if image is present in the flash\n");
             }
             break;
         }
@@ -371,8 +1734,13 @@ int read_dfu_image(char *file)
             fprintf(stderr,"dfu_upload error (%d)\n", numBytes);
             break;
         }
-        fwrite(block_data, 1, block_size, outFile);
+        fwrite(block_data, 1, numBytes, outFile);
         block_count++;
+        /* A short block is the last block of the image */
+        if ((unsigned int)numBytes < block_size)
+        {
+            break;
+        }
     }
 
     fclose(outFile);
@@ -392,14 +1760,20 @@ static void print_usage(const char *program_name, const char *error_msg)
     fprintf(stderr, "ERROR: %s\n\n", error_msg);
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "     %s --listdevices\n", program_name);
-    fprintf(stderr, "     %s DEVICE_PID COMMAND\n", program_name);
+    fprintf(stderr, "     %s DEVICE_PID [--all] [--serial <serial>] [--path <path>] COMMAND\n", program_name);
 
     fprintf(stderr, "    Where DEVICE_PID can be a hex value or a name from:\n");
     print_device_list(stderr, "      ");
 
+    fprintf(stderr, "    --all updates every device with DEVICE_PID at once, --serial and --path only\n");
+    fprintf(stderr, "    those with the serial number or at the bus path (see --listdevices).\n");
     fprintf(stderr, "    And COMMAND is one of:\n");
-    fprintf(stderr, "       --download <firmware> : write an upgrade image\n");
+    fprintf(stderr, "       --download <firmware> [--compress] [--background] : write an upgrade image, compressed for\n");
+    fprintf(stderr, "                               transfer if supported, in the background while audio streams\n");
+    fprintf(stderr, "       --delta <firmware>    : write only the pages of an upgrade image which differ\n");
+    fprintf(stderr, "       --compress <firmware> <output> : write a compressed upgrade image with a DFU suffix\n");
     fprintf(stderr, "       --upload <firmware>   : read the upgrade image\n");
+    fprintf(stderr, "       --verify <firmware>   : check the upgrade image matches, without reading it back\n");
     fprintf(stderr, "       --revertfactory       : revert to the factory image\n");
     fprintf(stderr, "       --savecustomstate     : \n");
     fprintf(stderr, "       --restorecustomstate  : \n");
@@ -437,8 +1811,18 @@ int main(int argc, char **argv)
     unsigned int upload = 0;
     unsigned int revert = 0;
     unsigned int listdev = 0;
+    unsigned int delta = 0;
+    unsigned int compress = 0;
+    unsigned int verify = 0;
+    unsigned int multi = 0;
+    unsigned int background = 0;
+    int result = 0;
 
     char *firmware_filename = NULL;
+    char *output_filename = NULL;
+    const char *serial_filter = NULL;
+    const char *path_filter = NULL;
+    dfu_image_t image;
 
     const char *program_name = argv[0];
 
@@ -465,26 +1849,100 @@ int main(int argc, char **argv)
     }
 
     char *device_pid = argv[1];
-    char *command = argv[2];
+    int arg = 2;
+
+    /* Device selection, any of which updates all the selected devices at once */
+    while (arg < argc)
+    {
+        if (strcmp(argv[arg], "--all") == 0)
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--serial") == 0 && arg + 1 < argc)
+        {
+            serial_filter = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--path") == 0 && arg + 1 < argc)
+        {
+            path_filter = argv[arg + 1];
+            arg += 2;
+        }
+        else
+        {
+            break;
+        }
+        multi = 1;
+    }
+
+    if (arg >= argc)
+    {
+        print_usage(program_name, "Not enough options passed to dfu application");
+    }
+
+    char *command = argv[arg];
 
     if (strcmp(command, "--download") == 0)
     {
-        if (argc < 4)
+        if (argc < arg + 2)
         {
             print_usage(program_name, "No filename specified for download option");
         }
-        firmware_filename = argv[3];
+        firmware_filename = argv[arg + 1];
+        download = 1;
+        for (int i = arg + 2; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--compress") == 0)
+            {
+                compress = 1;
+            }
+            else if (strcmp(argv[i], "--background") == 0)
+            {
+                background = 1;
+            }
+            else
+            {
+                print_usage(program_name, "Invalid option passed to dfu application");
+            }
+        }
+    }
+    else if (strcmp(command, "--compress") == 0)
+    {
+        if (argc < arg + 3)
+        {
+            print_usage(program_name, "No filenames specified for compress option");
+        }
+        firmware_filename = argv[arg + 1];
+        output_filename = argv[arg + 2];
+    }
+    else if (strcmp(command, "--delta") == 0)
+    {
+        if (argc < arg + 2)
+        {
+            print_usage(program_name, "No filename specified for delta option");
+        }
+        firmware_filename = argv[arg + 1];
         download = 1;
+        delta = 1;
     }
     else if (strcmp(command, "--upload") == 0)
     {
-        if (argc < 4)
+        if (argc < arg + 2)
         {
             print_usage(program_name, "No filename specified for upload option");
         }
-        firmware_filename = argv[3];
+        firmware_filename = argv[arg + 1];
         upload = 1;
     }
+    else if (strcmp(command, "--verify") == 0)
+    {
+        if (argc < arg + 2)
+        {
+            print_usage(program_name, "No filename specified for verify option");
+        }
+        firmware_filename = argv[arg + 1];
+        verify = 1;
+    }
     else if (strcmp(command, "--revertfactory") == 0)
     {
         revert = 1;
@@ -499,6 +1957,36 @@ int main(int argc, char **argv)
     {
         return -1;
     }
+
+    /* Check the image before the device is detached */
+    if (firmware_filename && !upload && load_dfu_image(firmware_filename, pid, &image) != 0)
+    {
+        return -1;
+    }
+
+    if (output_filename)
+    {
+        if (!image.compressed)
+        {
+            compress_dfu_image(&image);
+        }
+        result = save_dfu_image(&image, output_filename, pid);
+        free_dfu_image(&image);
+        libusb_exit(NULL);
+        return result;
+    }
+
+    if (multi)
+    {
+        if ((!download && !verify) || background)
+        {
+            print_usage(program_name, "Only --download, --delta and --verify can be used with several devices");
+        }
+        result = update_devices(pid, serial_filter, path_filter, &image, delta, compress, verify);
+        free_dfu_image(&image);
+        libusb_exit(NULL);
+        return result;
+    }
 //#define START_IN_DFU 1
 #ifndef START_IN_DFU
     r = find_xmos_device(0, pid, 0);
@@ -515,6 +2003,16 @@ int main(int argc, char **argv)
         return -1;
     }
     printf("XMOS DFU application started - Interface %d claimed\n", XMOS_DFU_IF);
+
+    if (background)
+    {
+        result = background_download(&image, compress);
+        free_dfu_image(&image);
+        libusb_release_interface(devh, XMOS_DFU_IF);
+        libusb_close(devh);
+        libusb_exit(NULL);
+        return result;
+    }
 #endif
 
     if(!listdev)
@@ -571,11 +2069,12 @@ int main(int argc, char **argv)
             return -1;
         }
 
-        printf("... DFU firmware upgrade device opened\n");
+        dfu_log(stdout, "... DFU firmware upgrade device opened\n");
 
-        if (download)
+        if (download || verify)
         {
-            write_dfu_image(firmware_filename);
+            result = dfu_mode_command(&image, delta, compress, verify);
+            free_dfu_image(&image);
             if(dfu_detach(XMOS_DFU_IF, 1000) < 0)
             {
                 fprintf(stderr, "error detaching\n");
@@ -593,7 +2092,7 @@ int main(int argc, char **argv)
         }
         else if (revert)
         {
-            printf("... Reverting device to factory image\n");
+            dfu_log(stdout, "... Reverting device to factory image\n");
             xmos_dfu_revertfactory();
             // Give device time to revert firmware
             Sleep(2 * 1000);
@@ -612,7 +2111,7 @@ int main(int argc, char **argv)
             }
         }
 
-        printf("... Returning device to application mode\n");
+        dfu_log(stdout, "... Returning device to application mode\n");
     }
     // END OF DFU APPLICATION MODE
 
@@ -620,5 +2119,5 @@ int main(int argc, char **argv)
     libusb_close(devh);
     libusb_exit(NULL);
 
-    return 0;
+    return result;
 }
@@ -1,39 +1,100 @@
 // Copyright 2011-2024 XMOS LIMITED.
 // This Software is subject to the terms of the XMOS Public Licence: Version 1.
 
+#if (XUA_DECOUPLE_BLOCK > 0) && (MIXER == 0)
+/* Position in the frames exchanged with decouple, see xua_decouple_frames.h. With the mixer
+ * enabled the frames are exchanged by the mixer instead */
+static unsigned decoupleSample = 0;
+static unsigned decoupleFrame = 0;
+#endif
+
+/* Receives a sample freq change (or other command) sent in place of samples */
+static inline unsigned ReceiveCommand(chanend c_out)
+{
+    unsigned command = inct(c_out);
+#ifndef CODEC_MASTER
+    if(dsdMode == DSD_MODE_OFF)
+    {
+#if (I2S_CHANS_ADC != 0 || I2S_CHANS_DAC != 0)
+        /* Set clocks low */
+        p_lrclk <: 0;
+        p_bclk <: 0;
+#endif
+    }
+    else
+    {
+#if(DSD_CHANS_DAC != 0)
+        /* DSD Clock might not be shared with lrclk or bclk... */
+        p_dsd_clk <: 0;
+#endif
+    }
+#endif
+#if (DSD_CHANS_DAC > 0)
+    if(dsdMode == DSD_MODE_DOP)
+        dsdMode = DSD_MODE_OFF;
+#endif
+    return command;
+}
+
 #pragma unsafe arrays
 static inline unsigned DoSampleTransfer(chanend ?c_out, const int readBuffNo, const unsigned underflowWord)
 {
     if(XUA_USB_EN && ((NUM_USB_CHAN_OUT > 0) || (NUM_USB_CHAN_IN > 0)))
     {
-        outuint(c_out, underflowWord);
-
-        /* Check for sample freq change (or other command) or new samples from mixer*/
-        if(testct(c_out))
+#if (XUA_DECOUPLE_BLOCK > 0) && (MIXER == 0)
+        /* Samples are exchanged through shared frames, with one request to decouple per block */
+        if(decoupleSample == 0)
         {
-            unsigned command = inct(c_out);
-#ifndef CODEC_MASTER
-            if(dsdMode == DSD_MODE_OFF)
+            outuint(c_out, underflowWord);
+
+            /* Check for sample freq change (or other command) */
+            if(testct(c_out))
             {
-#if (I2S_CHANS_ADC != 0 || I2S_CHANS_DAC != 0)
-                /* Set clocks low */
-                p_lrclk <: 0;
-                p_bclk <: 0;
-#endif
+                decoupleFrame = 0;
+                return ReceiveCommand(c_out);
             }
-            else
+
+            /* Decouple releases us straight away and processes the frame we have finished with */
+            inuint(c_out);
+            decoupleFrame ^= 1;
+        }
+
+        unsafe
+        {
+#if NUM_USB_CHAN_OUT > 0
+            int volatile * unsafe frameOut = g_decoupleFramesOut + (decoupleFrame * XUA_DECOUPLE_FRAME_OUT_WORDS)
+                                                + (decoupleSample * NUM_USB_CHAN_OUT);
+#pragma loop unroll
+            for(int i = 0; i < NUM_USB_CHAN_OUT; i++)
             {
-#if(DSD_CHANS_DAC != 0)
-                /* DSD Clock might not be shared with lrclk or bclk... */
-                p_dsd_clk <: 0;
-#endif
+                samplesOut[i] = frameOut[i];
             }
 #endif
-#if (DSD_CHANS_DAC > 0)
-            if(dsdMode == DSD_MODE_DOP)
-                dsdMode = DSD_MODE_OFF;
+            /* Run user code */
+            UserBufferManagement(samplesOut, samplesIn[readBuffNo]);
+
+#if NUM_USB_CHAN_IN > 0
+            int volatile * unsafe frameIn = g_decoupleFramesIn + (decoupleFrame * XUA_DECOUPLE_FRAME_IN_WORDS)
+                                                + (decoupleSample * NUM_USB_CHAN_IN);
+#pragma loop unroll
+            for(int i = 0; i < NUM_USB_CHAN_IN; i++)
+            {
+                frameIn[i] = samplesIn[readBuffNo][i];
+            }
 #endif
-                return command;
+        }
+
+        if(++decoupleSample == XUA_DECOUPLE_BLOCK)
+        {
+            decoupleSample = 0;
+        }
+#else
+        outuint(c_out, underflowWord);
+
+        /* Check for sample freq change (or other command) or new samples from mixer*/
+        if(testct(c_out))
+        {
+            return ReceiveCommand(c_out);
         }
         else
         {
@@ -58,6 +119,7 @@ static inline unsigned DoSampleTransfer(chanend ?c_out, const int readBuffNo, co
             }
 #endif
         }
+#endif
     }
     else
     {
@@ -0,0 +1,30 @@
+// Copyright 2024 XMOS LIMITED.
+// This Software is subject to the terms of the XMOS Public Licence: Version 1.
+#ifndef _XUA_DECOUPLE_FRAMES_H_
+#define _XUA_DECOUPLE_FRAMES_H_
+
+#if (XUA_DECOUPLE_BLOCK > 0)
+
+/* Words in a frame of XUA_DECOUPLE_BLOCK samples of every channel. The extra word avoids zero
+ * sized frames when there are no channels in one direction */
+#define XUA_DECOUPLE_FRAME_OUT_WORDS    ((XUA_DECOUPLE_BLOCK * NUM_USB_CHAN_OUT) + 1)
+#define XUA_DECOUPLE_FRAME_IN_WORDS     ((XUA_DECOUPLE_BLOCK * NUM_USB_CHAN_IN) + 1)
+
+/* Frames exchanged between decouple and the mixer/AudioHub, defined in decouple.xc.
+ *
+ * Each direction has two frames. At the start of each block the mixer/AudioHub sends a request
+ * word, receives a word back and moves to the other frame. Decouple then empties the IN frame and
+ * refills the OUT frame the mixer/AudioHub has just handed back, which it uses again after the next
+ * request. Both sides start from frame 0 again after a command from decouple.
+ *
+ * When decouple is on another tile (XUA_DECOUPLE_BRIDGE) these are the frames on AUDIO_IO_TILE,
+ * and XUA_DecoupleBridge() passes each frame handed back over the channel to decouple's copy */
+unsafe
+{
+    extern int volatile * const unsafe g_decoupleFramesOut;
+    extern int volatile * const unsafe g_decoupleFramesIn;
+}
+
+#endif
+
+#endif
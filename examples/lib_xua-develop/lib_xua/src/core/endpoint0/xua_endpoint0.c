@@ -287,6 +287,71 @@ void XUA_Endpoint0_setVendorId(unsigned short vid) {
 #endif // AUDIO_CLASS == 1}
 }
 
+#if (XUA_LOW_LATENCY) && (NUM_USB_CHAN_OUT > 0)
+/* Low latency OUT buffer state, in decouple.xc */
+extern unsigned g_outPrefillTarget;
+extern unsigned g_outPrefillRequest;
+extern unsigned g_outUnderflowCount;
+extern int g_outPrefillBytes;
+extern int g_outPacketBytes;
+extern unsigned g_outLowWaterHist[XUA_LATENCY_HIST_BINS];
+extern unsigned g_outHighWaterHist[XUA_LATENCY_HIST_BINS];
+
+/* Vendor requests to read the OUT buffer latency state and set its prefill target */
+static int LatencyRequests(XUD_ep ep0_out, XUD_ep ep0_in, USB_SetupPacket_t *sp)
+{
+    unsigned bmRequestType = (sp->bmRequestType.Direction<<7) | (sp->bmRequestType.Type<<5) | (sp->bmRequestType.Recipient);
+
+    if((bmRequestType == USB_BMREQ_D2H_VENDOR_DEV) && (sp->bRequest == XUA_REQUEST_GET_LATENCY))
+    {
+        unsigned data[4 + (2 * XUA_LATENCY_HIST_BINS)];
+
+        data[0] = g_outPrefillTarget;
+        data[1] = g_outPrefillBytes;
+        data[2] = g_outPacketBytes;
+        data[3] = g_outUnderflowCount;
+        for(int i = 0; i < XUA_LATENCY_HIST_BINS; i++)
+        {
+            data[4 + i] = g_outLowWaterHist[i];
+            data[4 + XUA_LATENCY_HIST_BINS + i] = g_outHighWaterHist[i];
+        }
+        return XUD_DoGetRequest(ep0_out, ep0_in, (unsigned char *)data, sizeof(data), sp->wLength);
+    }
+
+    if((bmRequestType == USB_BMREQ_H2D_VENDOR_DEV) && (sp->bRequest == XUA_REQUEST_SET_LATENCY)
+        && (sp->wValue != 0) && (sp->wLength == 0))
+    {
+        /* Applied by decouple at the next stream start */
+        g_outPrefillRequest = sp->wValue;
+        return XUD_DoSetRequestStatus(ep0_in);
+    }
+
+    return XUD_RES_ERR;
+}
+#endif
+
+#if (XUA_DECOUPLE_TELEMETRY)
+/* Decouple buffer telemetry, in decouple.xc */
+extern unsigned g_decoupleTelemetry[XUA_TELEMETRY_WORDS];
+
+/* Vendor request to read the decouple buffer telemetry */
+static int TelemetryRequests(XUD_ep ep0_out, XUD_ep ep0_in, USB_SetupPacket_t *sp)
+{
+    unsigned bmRequestType = (sp->bmRequestType.Direction<<7) | (sp->bmRequestType.Type<<5) | (sp->bmRequestType.Recipient);
+
+    if((bmRequestType == USB_BMREQ_D2H_VENDOR_DEV) && (sp->bRequest == XUA_REQUEST_GET_TELEMETRY))
+    {
+        unsigned data[XUA_TELEMETRY_WORDS];
+
+        /* Take a copy so the words sent are from (close to) the same moment */
+        memcpy(data, g_decoupleTelemetry, sizeof(data));
+        return XUD_DoGetRequest(ep0_out, ep0_in, (unsigned char *)data, sizeof(data), sp->wLength);
+    }
+
+    return XUD_RES_ERR;
+}
+#endif
+
 #if (MIXER)
 void InitLocalMixerState()
 {
@@ -917,10 +982,14 @@ void XUA_Endpoint0_loop(XUD_Result_t result, USB_SetupPacket_t sp, chanend c_ep0
                     if (interfaceNum == DFU_IF)
                     {
                         int reset = 0;
+                        int background = 0;
+#if (XUA_DFU_BACKGROUND == 1)
+                        background = DFUBackgroundActive() || (sp.bRequest == XMOS_DFU_BACKGROUND);
+#endif
 
                         /* If running in application mode stop audio */
-                        /* Don't interupt audio for save and restore cmds */
-                        if (!DFU_mode_active && !notify_audio_stop_for_DFU)
+                        /* Don't interupt audio for save and restore cmds, or for background download requests */
+                        if (!DFU_mode_active && !notify_audio_stop_for_DFU && !background)
                         {
                             /* Send STOP_AUDIO_FOR_DFU command. This will either pass through
                              * buffering system (i.e. ep_buffer/decouple) if the device has USB audio
@@ -1056,6 +1125,18 @@ void XUA_Endpoint0_loop(XUD_Result_t result, USB_SetupPacket_t sp, chanend c_ep0
                 }
             }
         }
+#endif
+#if (XUA_LOW_LATENCY) && (NUM_USB_CHAN_OUT > 0)
+        if(result == XUD_RES_ERR)
+        {
+            result = LatencyRequests(ep0_out, ep0_in, &sp);
+        }
+#endif
+#if (XUA_DECOUPLE_TELEMETRY)
+        if(result == XUD_RES_ERR)
+        {
+            result = TelemetryRequests(ep0_out, ep0_in, &sp);
+        }
 #endif
         if(result == XUD_RES_ERR)
         {
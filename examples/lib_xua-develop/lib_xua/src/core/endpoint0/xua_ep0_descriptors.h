@@ -834,8 +834,8 @@ typedef struct
     0x0f,                                 /* 2    bmAttributes */ \
     DFU_DETACH_TIME_OUT & 0xFF,           /* 3    wDetachTimeOut */ \
     (DFU_DETACH_TIME_OUT >> 8) & 0xFF,    /* 4    wDetachTimeOut */ \
-    0x40,                                 /* 5    wTransferSize */ \
-    0x00,                                 /* 6    wTransferSize */ \
+    XUA_DFU_TRANSFER_SIZE & 0xFF,         /* 5    wTransferSize */ \
+    (XUA_DFU_TRANSFER_SIZE >> 8) & 0xFF,  /* 6    wTransferSize */ \
     0x10,                                 /* 7    bcdDFUVersion */ \
     0x01                                /* 7    bcdDFUVersion */
 
@@ -29,6 +29,29 @@ enum
 #define SET_STREAM_FORMAT_OUT   8
 #define SET_STREAM_FORMAT_IN    9
 
+/* Low latency OUT buffer (XUA_LOW_LATENCY) */
+#define XUA_LATENCY_HIST_BINS   (8)     /* Fill histogram bins, in packets, the last bin counts any more */
+#define XUA_LATENCY_WINDOW      (1000)  /* Packets per window of the fill histograms */
+#define XUA_LATENCY_MIN_WINDOWS (8)     /* Windows observed before the prefill target is lowered */
+
+/* Words of the decouple telemetry (XUA_DECOUPLE_TELEMETRY). Fill levels are in bytes, including
+ * packet length words, over the last complete interval, and 0 if no packets were seen */
+enum
+{
+    XUA_TELEMETRY_OUT_UNDERFLOWS,   /* OUT buffer ran empty while streaming */
+    XUA_TELEMETRY_OUT_OVERFLOWS,    /* OUT buffer had no space for a packet from the host */
+    XUA_TELEMETRY_IN_UNDERFLOWS,    /* IN buffer ran empty, zero packets sent to the host */
+    XUA_TELEMETRY_IN_OVERFLOWS,     /* IN buffer full, oldest packets dropped */
+    XUA_TELEMETRY_OUT_FILL_MIN,
+    XUA_TELEMETRY_OUT_FILL_MAX,
+    XUA_TELEMETRY_IN_FILL_MIN,
+    XUA_TELEMETRY_IN_FILL_MAX,
+    XUA_TELEMETRY_INTERVALS,        /* Intervals completed, the newest feedback value is at
+                                     * (XUA_TELEMETRY_INTERVALS - 1) % XUA_DECOUPLE_TELEMETRY_HISTORY */
+    XUA_TELEMETRY_FEEDBACK,         /* XUA_DECOUPLE_TELEMETRY_HISTORY feedback values (16.16) */
+    XUA_TELEMETRY_WORDS = XUA_TELEMETRY_FEEDBACK + XUA_DECOUPLE_TELEMETRY_HISTORY
+};
+
 #include "dsd_support.h"
 
 #endif
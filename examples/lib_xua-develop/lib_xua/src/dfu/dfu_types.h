@@ -15,6 +15,28 @@
 #define XMOS_DFU_RESETINTODFU  0xf2
 #define XMOS_DFU_RESETFROMDFU  0xf3
 #define XMOS_DFU_SELECTIMAGE   0xf4
+#define XMOS_DFU_GETPAGEHASHES 0xf5 // D2H, wValue first page: number of image pages then CRC-32, CRC-32C per page
+#define XMOS_DFU_WRITEPAGES    0xf6 // H2D, wValue first page: whole pages to program in place, wLength 0 to flush
+#define XMOS_DFU_GETFEATURES   0xf7 // D2H: word of XMOS_DFU_FEATURE_ bits
+#define XMOS_DFU_GETIMAGECRC   0xf8 // D2H: number of image pages then CRC-32, CRC-32C of those pages
+#define XMOS_DFU_GETRESUME     0xf9 // D2H: number of pages programmed by an interrupted download then CRC-32, CRC-32C of those pages
+#define XMOS_DFU_RESUMEDNLOAD  0xfa // H2D, wValue page: continue an interrupted download with DFU_DNLOAD from that page
+#define XMOS_DFU_SETIMAGESIZE  0xfb // H2D, wLength 4: size in bytes of the image the next download will program
+#define XMOS_DFU_BACKGROUND    0xfc // H2D, in application mode: start a download while audio streams, booted on the next reset
+
+// XMOS_DFU_GETFEATURES bits
+#define XMOS_DFU_FEATURE_PAGE_HASHES (1 << 0) // XMOS_DFU_GETPAGEHASHES and XMOS_DFU_WRITEPAGES supported
+#define XMOS_DFU_FEATURE_COMPRESSED  (1 << 1) // Compressed images accepted by DFU_DNLOAD
+#define XMOS_DFU_FEATURE_IMAGE_CRC   (1 << 2) // XMOS_DFU_GETIMAGECRC supported
+#define XMOS_DFU_FEATURE_RESUME      (1 << 3) // XMOS_DFU_GETRESUME and XMOS_DFU_RESUMEDNLOAD supported
+#define XMOS_DFU_FEATURE_IMAGE_SIZE  (1 << 4) // XMOS_DFU_SETIMAGESIZE supported
+#define XMOS_DFU_FEATURE_BACKGROUND  (1 << 5) // XMOS_DFU_BACKGROUND supported
+
+// Compressed image stream, see flash_cmd_write_image_data()
+#define XMOS_DFU_LZ_MAGIC          (0x315a4c58) // "XLZ1", little endian
+#define XMOS_DFU_LZ_HEADER_BYTES   (8)          // Magic, then uncompressed size
+#define XMOS_DFU_LZ_WINDOW_BYTES   (4096)
+#define XMOS_DFU_LZ_MIN_MATCH      (3)
 
 // DFU States
 #define STATE_APP_IDLE                  0x00
@@ -47,11 +69,20 @@
 #define DFU_errUNKNOWN      0x0E // Something went wrong, but the device does not know what it was
 #define DFU_errSTALLEDPKT   0x0F // Device stalled an unexpected request.
 
-#define _DFU_TRANSFER_SIZE_BYTES (64)   // bMaxPacketSize0 in DFU device descriptor
+#define _DFU_MAX_PACKET_SIZE_BYTES (64)  // bMaxPacketSize0 in DFU device descriptor
+#define _DFU_TRANSFER_SIZE_BYTES (XUA_DFU_TRANSFER_SIZE) // wTransferSize in DFU functional descriptor
 #define _DFU_TRANSFER_SIZE_WORDS (_DFU_TRANSFER_SIZE_BYTES/4)
 #define _FLASH_PAGE_SIZE_BYTES    (256)
-#define _NUM_DFU_PAGES_PER_FLASH_PAGE (_FLASH_PAGE_SIZE_BYTES/_DFU_TRANSFER_SIZE_BYTES)
 
-#if (_FLASH_PAGE_SIZE_BYTES % _DFU_TRANSFER_SIZE_BYTES)
-#error _FLASH_PAGE_SIZE_BYTES should be a multiple of _DFU_TRANSFER_SIZE_BYTES
+#if (_DFU_TRANSFER_SIZE_BYTES < _DFU_MAX_PACKET_SIZE_BYTES) || (_DFU_TRANSFER_SIZE_BYTES > 4096)
+#error XUA_DFU_TRANSFER_SIZE should be between _DFU_MAX_PACKET_SIZE_BYTES and 4096
+#endif
+
+// Smaller transfers are buffered into whole pages, larger ones must carry whole pages
+#if (_DFU_TRANSFER_SIZE_BYTES < _FLASH_PAGE_SIZE_BYTES) && (_FLASH_PAGE_SIZE_BYTES % _DFU_TRANSFER_SIZE_BYTES)
+#error XUA_DFU_TRANSFER_SIZE below _FLASH_PAGE_SIZE_BYTES should divide it
+#endif
+
+#if (_DFU_TRANSFER_SIZE_BYTES >= _FLASH_PAGE_SIZE_BYTES) && (_DFU_TRANSFER_SIZE_BYTES % _FLASH_PAGE_SIZE_BYTES)
+#error XUA_DFU_TRANSFER_SIZE should be a multiple of _FLASH_PAGE_SIZE_BYTES
 #endif
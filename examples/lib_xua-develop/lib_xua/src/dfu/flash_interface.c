@@ -7,24 +7,34 @@
 #include <xclib.h>
 
 #include "xua.h"
-#include "dfu_types.h" // for _FLASH_PAGE_SIZE_BYTES and _NUM_DFU_PAGES_PER_FLASH_PAGE defines
+#include "dfu_types.h" // for _FLASH_PAGE_SIZE_BYTES define
+#include "flash_interface.h"
 
 #if (XUA_DFU_EN == 1)
 
-/* Defines flash area to erase on first DFU download request received
+/* Defines flash area reserved for an upgrade image after the factory image
  *
- * Flash library will round it up to the nearest sector, e.g. 4KB
- *
- * XS2 internal flash IS25LQ016B takes 70ms to erase one sector
- * 128KB will take over 2 seconds, for instance
- *
- * Your host software might implement a 5sec timeout as per USB spec 9.2.6.1,
- * and 5 seconds is just over 300KB
+ * Sectors are only erased as a download reaches them, so the time spent erasing
+ * is proportional to the size of the new image rather than this area
  */
 #ifndef FLASH_MAX_UPGRADE_SIZE
 #define FLASH_MAX_UPGRADE_SIZE (128 * 1024)
 #endif
 
+/* Flash kept erased ahead of the page being programmed by a download
+ *
+ * XS2 internal flash IS25LQ016B takes 70ms to erase one sector, which is spent
+ * handling the block of the download which comes within this of the sector
+ */
+#ifndef FLASH_ERASE_AHEAD_SIZE
+#define FLASH_ERASE_AHEAD_SIZE (4096)
+#endif
+
+/* Largest flash sector supported by in-place page writes (delta updates) */
+#ifndef FLASH_MAX_SECTOR_SIZE
+#define FLASH_MAX_SECTOR_SIZE (4096)
+#endif
+
 #define FLASH_ERROR() do {} while(0)
 
 static int flash_device_open = 0;
@@ -32,9 +42,102 @@ static fl_BootImageInfo factory_image;
 static fl_BootImageInfo upgrade_image;
 
 static int upgrade_image_valid = 0;
-static int current_flash_subpage_index = 0;
+static unsigned current_flash_page_offset = 0;
+static int current_flash_read_done = 0;
 static unsigned char current_flash_page_data[_FLASH_PAGE_SIZE_BYTES];
 
+static int sector_cache_num = -1;
+static int sector_cache_dirty = 0;
+static unsigned sector_cache_address;
+static unsigned sector_cache_size;
+static unsigned char sector_cache_data[FLASH_MAX_SECTOR_SIZE];
+
+/* Programming a download
+ *
+ * Pages are programmed in order from image_write_address, which is 0 when no
+ * download is in progress as the factory image always starts the flash. Rather
+ * than erasing all the space for an upgrade image when a download starts, each
+ * sector is erased when the write pointer comes within FLASH_ERASE_AHEAD_SIZE of
+ * it, or of the end of the image if its size was announced. Sectors which are
+ * already blank are not erased. The flash is erased from image_write_address to
+ * image_erase_address.
+ *
+ * So the flash itself records how far a download got, even across a reset. An
+ * interrupted download can continue from the first run of erased pages which
+ * reaches the end of its sector: the pages before it were programmed by the
+ * download, and the rest of its sector has not been programmed since its erase.
+ */
+static unsigned image_write_address = 0;
+static unsigned image_write_end;
+static unsigned image_erase_address;
+static unsigned image_erase_limit;
+static unsigned image_size = 0;
+static int resume_pages = -1;
+
+/* Previous upgrade images are deleted a sector at a time, from erase_all_address to erase_all_end.
+ * The first sector holds the image header, so an image never boots once its erase has started */
+static unsigned erase_all_address = 0;
+static unsigned erase_all_end = 0;
+static unsigned char blank_check_data[_FLASH_PAGE_SIZE_BYTES];
+
+/* Compressed image stream (LZSS) decoder
+ *
+ * The stream header is XMOS_DFU_LZ_MAGIC and the uncompressed image size, both
+ * little endian words. Then each flag byte describes the next eight items, LSB
+ * first: a set bit is a literal byte, a clear bit a match of two bytes
+ * (distance - 1) & 0xff, ((distance - 1) >> 8) << 4 | length code. A length
+ * code of 0 to 14 is a match of XMOS_DFU_LZ_MIN_MATCH to XMOS_DFU_LZ_MIN_MATCH + 14
+ * bytes, and 15 is followed by a byte to add to XMOS_DFU_LZ_MIN_MATCH + 15.
+ *
+ * Matches refer to the last XMOS_DFU_LZ_WINDOW_BYTES of the image, which are kept
+ * in the sector cache as in-place page writes are not used during a download.
+ */
+#if (FLASH_MAX_SECTOR_SIZE < XMOS_DFU_LZ_WINDOW_BYTES)
+#error FLASH_MAX_SECTOR_SIZE must be at least XMOS_DFU_LZ_WINDOW_BYTES
+#endif
+#define lz_window sector_cache_data
+
+enum lz_decode_state
+{
+    LZ_STATE_FLAGS,
+    LZ_STATE_ITEM,
+    LZ_STATE_MATCH,
+    LZ_STATE_MATCH_LENGTH
+};
+
+static int image_data_start = 1;
+static int lz_active = 0;
+static enum lz_decode_state lz_state;
+static unsigned lz_flags;
+static unsigned lz_distance;
+static unsigned lz_image_size;
+static unsigned lz_output_count;
+
+/* Nibble tables for the reflected CRC-32 (0xEDB88320) and CRC-32C (0x82F63B78) polynomials */
+static const unsigned crc32_table[16] =
+{
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static const unsigned crc32c_table[16] =
+{
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
+
+/* Continue a CRC (initially 0xffffffff, inverted when complete) over length bytes */
+static unsigned crc_update(unsigned crc, const unsigned table[16], const unsigned char *data, unsigned length)
+{
+    for (unsigned i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return crc;
+}
+
 int flash_cmd_enable_ports() __attribute__ ((weak));
 int flash_cmd_enable_ports() {
   return 0;
@@ -104,61 +207,181 @@ int flash_cmd_deinit(void)
     return 0;
 }
 
-void flash_cmd_read_page(unsigned char *data)
+unsigned flash_cmd_read_image_data(unsigned char *data, unsigned length, int restart)
 {
+    unsigned bytes_read = 0;
+
     if (!upgrade_image_valid)
     {
-        *(unsigned int *)data = 1;
-        return;
+        return 0;
     }
 
-    if (*(unsigned int *)data == 0)
+    if (restart)
     {
         fl_startImageRead(&upgrade_image);
+        current_flash_page_offset = _FLASH_PAGE_SIZE_BYTES;
+        current_flash_read_done = 0;
+    }
+
+    while (bytes_read < length)
+    {
+        if (current_flash_page_offset == _FLASH_PAGE_SIZE_BYTES)
+        {
+            // Read the next whole page of the image into the page buffer
+            if (current_flash_read_done || (fl_readImagePage(current_flash_page_data) != 0))
+            {
+                current_flash_read_done = 1;
+                break;
+            }
+            current_flash_page_offset = 0;
+        }
+
+        unsigned n = _FLASH_PAGE_SIZE_BYTES - current_flash_page_offset;
+        if (n > length - bytes_read)
+            n = length - bytes_read;
+
+        memcpy(&data[bytes_read], &current_flash_page_data[current_flash_page_offset], n);
+        current_flash_page_offset += n;
+        bytes_read += n;
+    }
+
+    return bytes_read;
+}
+
+
+static int page_erased(const unsigned char page[])
+{
+    for (unsigned i = 0; i < _FLASH_PAGE_SIZE_BYTES; i++)
+    {
+        if (page[i] != 0xff)
+        {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    current_flash_subpage_index = 0;
+/* Returns the address of the first sector after the factory image, where an upgrade image is added */
+static unsigned get_upgrade_address(void)
+{
+    int num_sectors = fl_getNumSectors();
 
-    if (fl_readImagePage(current_flash_page_data) == 0)
+    for (int i = 0; i < num_sectors; i++)
     {
-        *(unsigned int *)data = 0;
-     }
-    else
+        unsigned sector_address = fl_getSectorAddress(i);
+
+        if (sector_address >= factory_image.startAddress + factory_image.size)
+        {
+            return sector_address;
+        }
+    }
+    return 0;
+}
+
+/* Returns the number of the sector containing address, -1 if there is none */
+static int get_sector_num(unsigned address)
+{
+    int num_sectors = fl_getNumSectors();
+
+    for (int i = 0; i < num_sectors; i++)
     {
-        *(unsigned int *)data = 1;
+        unsigned sector_address = fl_getSectorAddress(i);
+
+        if ((address >= sector_address) && (address < sector_address + fl_getSectorSize(i)))
+        {
+            return i;
+        }
     }
-    return;
+    return -1;
 }
 
-int flash_cmd_read_page_data(unsigned char *data)
+/* Prepare to program a download from address, with the flash up to erase_address already erased */
+static void start_image_write(unsigned address, unsigned erase_address)
 {
-    unsigned char *page_data_ptr = &current_flash_page_data[current_flash_subpage_index * _DFU_TRANSFER_SIZE_BYTES];
-    memcpy(data, page_data_ptr, _DFU_TRANSFER_SIZE_BYTES);
+    unsigned upgrade_address = get_upgrade_address();
 
-    current_flash_subpage_index++;
+    image_write_address = upgrade_address ? address : 0;
+    image_erase_address = erase_address;
+    image_write_end = upgrade_address + FLASH_MAX_UPGRADE_SIZE;
+    if (image_write_end > fl_getBootPartitionSize())
+    {
+        image_write_end = fl_getBootPartitionSize();
+    }
 
-    return _DFU_TRANSFER_SIZE_BYTES;
+    image_erase_limit = image_write_end;
+    if ((image_size != 0) && (upgrade_address + image_size < image_erase_limit))
+    {
+        image_erase_limit = upgrade_address + image_size;
+    }
 }
 
+/* Erase whole sectors from image_erase_address to at least end, returns non-zero on error */
+static int erase_image_space(unsigned end)
+{
+    while (image_erase_address < end)
+    {
+        int sector_num = get_sector_num(image_erase_address);
+        int erased = 1;
+
+        if (sector_num < 0)
+        {
+            return 1;
+        }
+
+        unsigned sector_address = fl_getSectorAddress(sector_num);
+        unsigned sector_size = fl_getSectorSize(sector_num);
+
+        // Reading a sector takes far less time than erasing it
+        for (unsigned offset = 0; erased && (offset < sector_size); offset += _FLASH_PAGE_SIZE_BYTES)
+        {
+            erased = (fl_readPage(sector_address + offset, blank_check_data) == 0) && page_erased(blank_check_data);
+        }
+
+        if (!erased && (fl_eraseSector(sector_num) != 0))
+        {
+            return 1;
+        }
+        image_erase_address = sector_address + sector_size;
+    }
+    return 0;
+}
+
+int flash_cmd_set_image_size(unsigned size)
+{
+    unsigned upgrade_address = get_upgrade_address();
+
+    if ((size > FLASH_MAX_UPGRADE_SIZE) || (upgrade_address == 0) || (upgrade_address + size > fl_getBootPartitionSize()))
+    {
+        return 1;
+    }
+    image_size = size;
+    return 0;
+}
 
 int flash_cmd_start_write_image()
 {
-    current_flash_subpage_index = 0;
-    int ret = fl_startImageAdd(&factory_image, FLASH_MAX_UPGRADE_SIZE, 0);
-    if(ret < 0)
-        FLASH_ERROR();
-    return ret;
+    unsigned upgrade_address = get_upgrade_address();
+
+    current_flash_page_offset = 0;
+    resume_pages = -1;
+
+    // Nothing is erased until the download reaches it
+    start_image_write(upgrade_address, upgrade_address);
+    return 0;
 }
 
-void flash_cmd_reset_subpage_index()
+void flash_cmd_reset_page_buffer()
 {
-    current_flash_subpage_index = 0;
+    current_flash_page_offset = 0;
+    image_data_start = 1;
+    lz_active = 0;
 }
 
 void flash_cmd_end_write_image()
 {
-     if (fl_endWriteImage() != 0)
-        FLASH_ERROR();
+    // Pages are programmed as they arrive, so there is no image write to end
+    image_write_address = 0;
+    image_size = 0;
 
     // Sanity check
     fl_BootImageInfo image = factory_image;
@@ -167,62 +390,571 @@ void flash_cmd_end_write_image()
 
 }
 
-int flash_cmd_write_page_data(unsigned char *data)
+/* Program the next page of the image being downloaded, returns a FLASH_IMAGE_ERR_ code on error */
+static int write_image_page(unsigned char page[])
 {
-    unsigned char *page_data_ptr = &current_flash_page_data[current_flash_subpage_index * _DFU_TRANSFER_SIZE_BYTES];
+    unsigned end = image_write_address + _FLASH_PAGE_SIZE_BYTES;
+    unsigned erase_end = end + FLASH_ERASE_AHEAD_SIZE;
+
+    if ((image_write_address == 0) || (end > image_write_end))
+    {
+        return FLASH_IMAGE_ERR_ADDRESS;
+    }
+
+    // Keep the flash erased ahead of the write pointer, but not beyond an announced image
+    if (erase_end > image_erase_limit)
+    {
+        erase_end = (end > image_erase_limit) ? end : image_erase_limit;
+    }
+
+    if ((erase_image_space(erase_end) != 0) || (fl_writePage(image_write_address, page) != 0))
+    {
+        return FLASH_IMAGE_ERR_WRITE;
+    }
+    image_write_address = end;
+    return 0;
+}
 
+int flash_cmd_write_page_data(unsigned char *data, unsigned length)
+{
     if (upgrade_image_valid)
     {
         return 0;
     }
 
-    if (current_flash_subpage_index >= _NUM_DFU_PAGES_PER_FLASH_PAGE)
+    while (length)
     {
-        return 0;
+        unsigned n = _FLASH_PAGE_SIZE_BYTES - current_flash_page_offset;
+        if (n > length)
+            n = length;
+
+        memcpy(&current_flash_page_data[current_flash_page_offset], data, n);
+        current_flash_page_offset += n;
+        data += n;
+        length -= n;
+
+        if (current_flash_page_offset == _FLASH_PAGE_SIZE_BYTES)
+        {
+            int error;
+
+            current_flash_page_offset = 0;
+            if ((error = write_image_page(current_flash_page_data)) != 0)
+            {
+                return error;
+            }
+        }
     }
 
-    memcpy(page_data_ptr, data, _DFU_TRANSFER_SIZE_BYTES);
+    return 0;
+}
 
-    current_flash_subpage_index++;
+static unsigned get_le32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned)data[3] << 24);
+}
 
-    if (current_flash_subpage_index == _NUM_DFU_PAGES_PER_FLASH_PAGE)
+/* Returns FLASH_IMAGE_ERR_FILE if the byte is beyond the end of the image, or the error writing a page */
+static int lz_output(unsigned char byte)
+{
+    if (lz_output_count == lz_image_size)
     {
-        if (fl_writeImagePage(current_flash_page_data) != 0)
-            FLASH_ERROR();
+        return FLASH_IMAGE_ERR_FILE;
     }
 
+    lz_window[lz_output_count & (XMOS_DFU_LZ_WINDOW_BYTES - 1)] = byte;
+    lz_output_count++;
+
+    current_flash_page_data[current_flash_page_offset++] = byte;
+    if (current_flash_page_offset == _FLASH_PAGE_SIZE_BYTES)
+    {
+        current_flash_page_offset = 0;
+        return write_image_page(current_flash_page_data);
+    }
     return 0;
 }
 
-int flash_cmd_erase_all(void)
+static int lz_copy_match(unsigned length)
 {
-    fl_BootImageInfo tmp_image = upgrade_image;
+    if (lz_distance > lz_output_count)
+    {
+        return FLASH_IMAGE_ERR_FILE;
+    }
 
-    if (upgrade_image_valid)
+    for (unsigned i = 0; i < length; i++)
     {
-        if (fl_deleteImage(&upgrade_image) != 0)
+        int error = lz_output(lz_window[(lz_output_count - lz_distance) & (XMOS_DFU_LZ_WINDOW_BYTES - 1)]);
+        if (error)
         {
-            FLASH_ERROR();
+            return error;
         }
+    }
+    return 0;
+}
+
+static void lz_next_item(void)
+{
+    lz_flags >>= 1;
+    lz_state = (lz_flags == 1) ? LZ_STATE_FLAGS : LZ_STATE_ITEM;
+}
 
-        // Keep deleting all upgrade images
-        // TODO Perhaps using replace would be nicer...
-        while(1)
+static int lz_decode(unsigned char *data, unsigned length)
+{
+    for (unsigned i = 0; i < length; i++)
+    {
+        unsigned char byte = data[i];
+        int error;
+
+        // Ignore any padding after the end of the stream
+        if (lz_output_count == lz_image_size)
         {
-            if (fl_getNextBootImage(&tmp_image) == 0)
-            {
-                if (fl_deleteImage(&tmp_image) != 0)
+            break;
+        }
+
+        switch (lz_state)
+        {
+            case LZ_STATE_FLAGS:
+                lz_flags = byte | 0x100; // Marks when all eight items are done
+                lz_state = LZ_STATE_ITEM;
+                break;
+
+            case LZ_STATE_ITEM:
+                if (lz_flags & 1)
+                {
+                    if ((error = lz_output(byte)) != 0)
+                    {
+                        return error;
+                    }
+                    lz_next_item();
+                }
+                else
+                {
+                    lz_distance = byte + 1;
+                    lz_state = LZ_STATE_MATCH;
+                }
+                break;
+
+            case LZ_STATE_MATCH:
+                lz_distance += (byte >> 4) << 8;
+                if ((byte & 0xf) == 0xf)
+                {
+                    lz_state = LZ_STATE_MATCH_LENGTH;
+                    break;
+                }
+                if ((error = lz_copy_match(XMOS_DFU_LZ_MIN_MATCH + (byte & 0xf))) != 0)
+                {
+                    return error;
+                }
+                lz_next_item();
+                break;
+
+            case LZ_STATE_MATCH_LENGTH:
+                if ((error = lz_copy_match(XMOS_DFU_LZ_MIN_MATCH + 0xf + byte)) != 0)
                 {
-                    FLASH_ERROR();
+                    return error;
                 }
+                lz_next_item();
+                break;
+        }
+    }
+    return 0;
+}
+
+int flash_cmd_write_image_data(unsigned char *data, unsigned length)
+{
+    if (upgrade_image_valid)
+    {
+        return 0;
+    }
+
+    if (image_data_start)
+    {
+        image_data_start = 0;
+
+        if ((length >= XMOS_DFU_LZ_HEADER_BYTES) && (get_le32(data) == XMOS_DFU_LZ_MAGIC))
+        {
+            lz_image_size = get_le32(&data[4]);
+            if ((lz_image_size == 0) || (lz_image_size > FLASH_MAX_UPGRADE_SIZE))
+            {
+                return FLASH_IMAGE_ERR_FILE;
             }
-            else
+
+            // The sector cache holds the window
+            sector_cache_num = -1;
+            lz_active = 1;
+            lz_state = LZ_STATE_FLAGS;
+            lz_output_count = 0;
+            data += XMOS_DFU_LZ_HEADER_BYTES;
+            length -= XMOS_DFU_LZ_HEADER_BYTES;
+        }
+    }
+
+    if (lz_active)
+    {
+        return lz_decode(data, length);
+    }
+    return flash_cmd_write_page_data(data, length);
+}
+
+int flash_cmd_flush_page_data()
+{
+    if (lz_active && (lz_output_count != lz_image_size))
+    {
+        return FLASH_IMAGE_ERR_FILE;
+    }
+
+    if (upgrade_image_valid || (current_flash_page_offset == 0))
+    {
+        return 0;
+    }
+
+    memset(&current_flash_page_data[current_flash_page_offset], 0, _FLASH_PAGE_SIZE_BYTES - current_flash_page_offset);
+    current_flash_page_offset = 0;
+
+    return write_image_page(current_flash_page_data);
+}
+
+unsigned flash_cmd_get_image_pages(void)
+{
+    if (!upgrade_image_valid)
+    {
+        return 0;
+    }
+    return (upgrade_image.size + _FLASH_PAGE_SIZE_BYTES - 1) / _FLASH_PAGE_SIZE_BYTES;
+}
+
+unsigned flash_cmd_get_page_hashes(unsigned first_page, unsigned count, unsigned hashes[])
+{
+    unsigned num_pages = flash_cmd_get_image_pages();
+    unsigned i;
+
+    // Hash what is in the flash, not what is pending in the sector cache
+    if (flash_cmd_flush_image_pages() != 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; (i < count) && (first_page + i < num_pages); i++)
+    {
+        unsigned address = upgrade_image.startAddress + (first_page + i) * _FLASH_PAGE_SIZE_BYTES;
+
+        if (fl_readPage(address, current_flash_page_data) != 0)
+        {
+            break;
+        }
+        hashes[2 * i] = ~crc_update(0xffffffff, crc32_table, current_flash_page_data, _FLASH_PAGE_SIZE_BYTES);
+        hashes[2 * i + 1] = ~crc_update(0xffffffff, crc32c_table, current_flash_page_data, _FLASH_PAGE_SIZE_BYTES);
+    }
+
+    return i;
+}
+
+unsigned flash_cmd_get_image_crcs(unsigned crcs[2])
+{
+    unsigned num_pages = flash_cmd_get_image_pages();
+    unsigned crc32 = 0xffffffff;
+    unsigned crc32c = 0xffffffff;
+
+    if (flash_cmd_flush_image_pages() != 0)
+    {
+        return 0;
+    }
+
+    for (unsigned i = 0; i < num_pages; i++)
+    {
+        if (fl_readPage(upgrade_image.startAddress + i * _FLASH_PAGE_SIZE_BYTES, current_flash_page_data) != 0)
+        {
+            return 0;
+        }
+        crc32 = crc_update(crc32, crc32_table, current_flash_page_data, _FLASH_PAGE_SIZE_BYTES);
+        crc32c = crc_update(crc32c, crc32c_table, current_flash_page_data, _FLASH_PAGE_SIZE_BYTES);
+    }
+
+    crcs[0] = ~crc32;
+    crcs[1] = ~crc32c;
+    return num_pages;
+}
+
+/* Load the sector containing address into the sector cache, programming the previous one */
+static int load_sector(unsigned address)
+{
+    int num_sectors = fl_getNumSectors();
+
+    if ((sector_cache_num >= 0) && (address >= sector_cache_address) && (address < sector_cache_address + sector_cache_size))
+    {
+        return 0;
+    }
+
+    if (flash_cmd_flush_image_pages() != 0)
+    {
+        return 1;
+    }
+
+    for (int i = 0; i < num_sectors; i++)
+    {
+        unsigned sector_address = fl_getSectorAddress(i);
+        unsigned sector_size = fl_getSectorSize(i);
+
+        if ((address >= sector_address) && (address < sector_address + sector_size))
+        {
+            // Never touch the factory image, nor sectors too large to cache
+            if ((sector_address < factory_image.startAddress + factory_image.size) || (sector_size > FLASH_MAX_SECTOR_SIZE))
             {
-                break;
+                return 1;
+            }
+
+            for (unsigned offset = 0; offset < sector_size; offset += _FLASH_PAGE_SIZE_BYTES)
+            {
+                if (fl_readPage(sector_address + offset, &sector_cache_data[offset]) != 0)
+                {
+                    return 1;
+                }
             }
+
+            sector_cache_num = i;
+            sector_cache_dirty = 0;
+            sector_cache_address = sector_address;
+            sector_cache_size = sector_size;
+            return 0;
         }
+    }
+
+    return 1;
+}
+
+int flash_cmd_write_image_pages(unsigned first_page, unsigned char *data, unsigned length)
+{
+    unsigned address;
+
+    if (!upgrade_image_valid || (length % _FLASH_PAGE_SIZE_BYTES) || (first_page >= FLASH_MAX_UPGRADE_SIZE / _FLASH_PAGE_SIZE_BYTES))
+    {
+        return 1;
+    }
+
+    address = upgrade_image.startAddress + first_page * _FLASH_PAGE_SIZE_BYTES;
+
+    // Pages may extend the image, but not beyond the space reserved for an upgrade image
+    if ((first_page * _FLASH_PAGE_SIZE_BYTES + length > FLASH_MAX_UPGRADE_SIZE) ||
+        (address + length > fl_getBootPartitionSize()))
+    {
+        return 1;
+    }
+
+    for (unsigned offset = 0; offset < length; offset += _FLASH_PAGE_SIZE_BYTES)
+    {
+        unsigned char *sector_page;
+
+        if (load_sector(address + offset) != 0)
+        {
+            return 1;
+        }
+
+        sector_page = &sector_cache_data[address + offset - sector_cache_address];
+        if (memcmp(sector_page, &data[offset], _FLASH_PAGE_SIZE_BYTES) != 0)
+        {
+            memcpy(sector_page, &data[offset], _FLASH_PAGE_SIZE_BYTES);
+            sector_cache_dirty = 1;
+        }
+    }
+
+    return 0;
+}
+
+int flash_cmd_flush_image_pages(void)
+{
+    fl_BootImageInfo image = factory_image;
+    int sector_num = sector_cache_num;
+    int dirty = sector_cache_dirty;
+
+    if (sector_num < 0)
+    {
+        return 0;
+    }
+
+    sector_cache_num = -1;
+    sector_cache_dirty = 0;
+
+    if (!dirty)
+    {
+        return 0;
+    }
+
+    if (fl_eraseSector(sector_num) != 0)
+    {
+        return 1;
+    }
+
+    for (unsigned offset = 0; offset < sector_cache_size; offset += _FLASH_PAGE_SIZE_BYTES)
+    {
+        unsigned char *page = &sector_cache_data[offset];
+
+        if (!page_erased(page) && (fl_writePage(sector_cache_address + offset, page) != 0))
+        {
+            return 1;
+        }
+    }
+
+    // The image header may have changed
+    if (fl_getNextBootImage(&image) == 0)
+    {
+        upgrade_image = image;
+    }
+
+    return 0;
+}
+
+unsigned flash_cmd_get_resume_point(unsigned crcs[2])
+{
+    unsigned address = get_upgrade_address();
+    unsigned end = address + FLASH_MAX_UPGRADE_SIZE;
+    unsigned crc32 = 0xffffffff;
+    unsigned crc32c = 0xffffffff;
+    int sector_num = get_sector_num(address);
+    int run_start = -1; // First page of the run of erased pages being read
+    unsigned i;
+
+    resume_pages = -1;
+    crcs[0] = ~crc32;
+    crcs[1] = ~crc32c;
+
+    if ((sector_num < 0) || (flash_cmd_flush_image_pages() != 0))
+    {
+        return 0;
+    }
+
+    if (end > fl_getBootPartitionSize())
+    {
+        end = fl_getBootPartitionSize();
+    }
+
+    unsigned sector_end = fl_getSectorAddress(sector_num) + fl_getSectorSize(sector_num);
+
+    for (i = 0; address + (i + 1) * _FLASH_PAGE_SIZE_BYTES <= end; i++)
+    {
+        unsigned page_address = address + i * _FLASH_PAGE_SIZE_BYTES;
+
+        if (page_address >= sector_end)
+        {
+            sector_num++;
+            sector_end = fl_getSectorAddress(sector_num) + fl_getSectorSize(sector_num);
+        }
+
+        if (fl_readPage(page_address, blank_check_data) != 0)
+        {
+            return 0;
+        }
+
+        if (!page_erased(blank_check_data))
+        {
+            run_start = -1;
+        }
+        else if (run_start < 0)
+        {
+            run_start = i;
+            crcs[0] = ~crc32;
+            crcs[1] = ~crc32c;
+        }
+        crc32 = crc_update(crc32, crc32_table, blank_check_data, _FLASH_PAGE_SIZE_BYTES);
+        crc32c = crc_update(crc32c, crc32c_table, blank_check_data, _FLASH_PAGE_SIZE_BYTES);
+
+        // Later sectors may not have been erased yet, so stop once the rest of a sector is erased
+        if ((run_start >= 0) && (page_address + _FLASH_PAGE_SIZE_BYTES == sector_end))
+        {
+            break;
+        }
+    }
+
+    if (run_start < 0)
+    {
+        // The whole space is programmed
+        run_start = i;
+        crcs[0] = ~crc32;
+        crcs[1] = ~crc32c;
+    }
+
+    resume_pages = run_start;
+    return run_start;
+}
+
+int flash_cmd_resume_write_image(unsigned first_page)
+{
+    unsigned address = get_upgrade_address() + first_page * _FLASH_PAGE_SIZE_BYTES;
+    int sector_num = get_sector_num(address);
+
+    // Only the point just reported is known to be followed by erased pages in its sector
+    if ((resume_pages < 0) || (first_page != (unsigned)resume_pages))
+    {
+        return 1;
+    }
+    resume_pages = -1;
+
+    // Later sectors are erased as the download reaches them
+    start_image_write(address, (sector_num < 0) ? address : fl_getSectorAddress(sector_num) + fl_getSectorSize(sector_num));
+
+    // The partial image is being rewritten, and is never a compressed stream
+    sector_cache_num = -1;
+    upgrade_image_valid = 0;
+    current_flash_page_offset = 0;
+    image_data_start = 0;
+    lz_active = 0;
+    return 0;
+}
+
+void flash_cmd_start_erase_all(void)
+{
+    fl_BootImageInfo tmp_image = upgrade_image;
+
+    // Discard any pending in-place page writes
+    sector_cache_num = -1;
+    resume_pages = -1;
+
+    erase_all_address = 0;
+    erase_all_end = 0;
+
+    if (upgrade_image_valid)
+    {
+        // Erase all upgrade images, which follow each other
+        erase_all_address = upgrade_image.startAddress;
+        erase_all_end = upgrade_image.startAddress + upgrade_image.size;
+
+        while (fl_getNextBootImage(&tmp_image) == 0)
+        {
+            erase_all_end = tmp_image.startAddress + tmp_image.size;
+        }
+    }
+}
+
+int flash_cmd_erase_all_step(void)
+{
+    if (erase_all_address < erase_all_end)
+    {
+        int sector_num = get_sector_num(erase_all_address);
+
+        if ((sector_num < 0) || (fl_eraseSector(sector_num) != 0))
+        {
+            return -1;
+        }
+        erase_all_address = fl_getSectorAddress(sector_num) + fl_getSectorSize(sector_num);
+    }
+
+    if (erase_all_address < erase_all_end)
+    {
+        return 1;
+    }
 
     upgrade_image_valid = 0;
+    return 0;
+}
+
+int flash_cmd_erase_all(void)
+{
+    int result;
+
+    flash_cmd_start_erase_all();
+    while ((result = flash_cmd_erase_all_step()) > 0);
+
+    if (result < 0)
+    {
+        FLASH_ERROR();
     }
     return 0;
 }
@@ -3,34 +3,113 @@
 #ifndef _flash_interface_h_
 #define _flash_interface_h_
 
+/* Errors returned by the functions writing upgrade image data */
+#define FLASH_IMAGE_ERR_FILE    (1) // Compressed image stream is invalid or incomplete
+#define FLASH_IMAGE_ERR_ADDRESS (2) // Image runs past the space for an upgrade image
+#define FLASH_IMAGE_ERR_WRITE   (3) // Flash erase or program failed
+
 int flash_cmd_init(void);
 
-/// Prepare to write a new image to the flash
+/**
+ * Announce the size in bytes of the image the next download will program, so
+ * the flash is not erased beyond it.
+ * Returns non-zero if the image would not fit in the space for an upgrade image.
+ */
+int flash_cmd_set_image_size(unsigned size);
+
+/// Prepare to write a new image to the flash, whose sectors are erased as they are reached
 int flash_cmd_start_write_image();
 
-/// Reset the subpage index back to 0
-void flash_cmd_reset_subpage_index();
+/// Discard any partial page of image data provided since the last page was written
+void flash_cmd_reset_page_buffer();
 
 /// Finish writing image to the flash
 void flash_cmd_end_write_image();
 
 /**
  * Provide upgrade image data. flash_cmd_start_write_image() must be called previously.
- * Once a page of data has been provided it is written to the device.
+ * Data of any length is buffered and written to the device a whole flash page at a time.
+ * Returns FLASH_IMAGE_ERR_ADDRESS or FLASH_IMAGE_ERR_WRITE if a page cannot be written.
+ */
+int flash_cmd_write_page_data(unsigned char [], unsigned length);
+/**
+ * Provide upgrade image data as flash_cmd_write_page_data(). If the image
+ * data provided since flash_cmd_reset_page_buffer() starts with a compressed
+ * image stream header, the stream is decompressed as it arrives.
+ * Returns FLASH_IMAGE_ERR_FILE if the compressed stream is invalid, otherwise
+ * as flash_cmd_write_page_data().
+ */
+int flash_cmd_write_image_data(unsigned char [], unsigned length);
+/**
+ * Pad any partial page of image data with zeros and write it to the device.
+ * Returns FLASH_IMAGE_ERR_FILE if a compressed image stream is incomplete,
+ * otherwise as flash_cmd_write_page_data().
+ */
+int flash_cmd_flush_page_data();
+/**
+ * Read up to length bytes of the upgrade image, a flash page at a time.
+ * If restart is non-zero the image is read from the start, otherwise reading
+ * continues from the end of the previous call.
+ * Returns the number of bytes read, which is less than length at the end of
+ * the image.
+ */
+unsigned flash_cmd_read_image_data(unsigned char [], unsigned length, int restart);
+/**
+ * Returns the number of flash pages in the upgrade image, 0 if there is none.
+ */
+unsigned flash_cmd_get_image_pages(void);
+/**
+ * Write the CRC-32 and CRC-32C of up to count pages of the upgrade image,
+ * starting at first_page, to consecutive pairs of words in hashes.
+ * Returns the number of pages hashed.
+ */
+unsigned flash_cmd_get_page_hashes(unsigned first_page, unsigned count, unsigned hashes[]);
+/**
+ * Write the CRC-32 and CRC-32C of all the pages of the upgrade image to
+ * crcs[0] and crcs[1].
+ * Returns the number of pages, 0 if there is no image or it cannot be read.
+ */
+unsigned flash_cmd_get_image_crcs(unsigned crcs[2]);
+/**
+ * Program whole pages of the existing upgrade image in place, starting at
+ * first_page. Each affected sector is read, modified and only erased and
+ * reprogrammed once writes move on to another sector or
+ * flash_cmd_flush_image_pages() is called.
+ * Returns non-zero on error.
+ */
+int flash_cmd_write_image_pages(unsigned first_page, unsigned char [], unsigned length);
+/**
+ * Program any pending sector written by flash_cmd_write_image_pages().
+ * Returns non-zero on error.
+ */
+int flash_cmd_flush_image_pages(void);
+/**
+ * Find how far an interrupted download got: the number of pages before the
+ * first run of erased pages in the space for the upgrade image which reaches
+ * the end of its sector. Writes the CRC-32 and CRC-32C of those pages to
+ * crcs[0] and crcs[1].
+ * Returns the number of pages, 0 if there are none or the flash cannot be read.
+ */
+unsigned flash_cmd_get_resume_point(unsigned crcs[2]);
+/**
+ * Continue an interrupted download from first_page, which must be the point
+ * last returned by flash_cmd_get_resume_point(). Image data then provided by
+ * flash_cmd_write_image_data() is programmed from that page, erasing only the
+ * later sectors, and is never decompressed.
+ * Returns non-zero if the download cannot be resumed from first_page.
  */
-int flash_cmd_write_page_data(unsigned char []);
+int flash_cmd_resume_write_image(unsigned first_page);
 /**
- * Read a page of data from the upgrade image.
- * If the first word of data is 0 the page is read from the start of the
- * upgrade image, otherwise the next page in the image will be read.
- * On return the first word of data is written with 1 if there is nothing to
- * read and 0 otherwise.
+ * Prepare to delete all the upgrade images, a sector at a time, with
+ * flash_cmd_erase_all_step().
  */
-void flash_cmd_read_page(unsigned char []);
+void flash_cmd_start_erase_all(void);
 /**
- * Get data previously read by flash_cmd_read_page().
+ * Erase the next sector of the upgrade images being deleted.
+ * Returns 1 while more sectors are left, 0 once all are erased and -1 on error.
  */
-int flash_cmd_read_page_data(unsigned char []);
+int flash_cmd_erase_all_step(void);
+/// Delete all the upgrade images
 int flash_cmd_erase_all(void);
 int flash_cmd_reboot(void);
 int flash_cmd_init(void);
@@ -38,7 +38,7 @@ USB_Descriptor_Device_t DFUdevDesc =
     .bDeviceClass                   = 0, /* See interface */
     .bDeviceSubClass                = 0, /* See interface */
     .bDeviceProtocol                = 0, /* See interface */
-    .bMaxPacketSize0                = _DFU_TRANSFER_SIZE_BYTES,
+    .bMaxPacketSize0                = _DFU_MAX_PACKET_SIZE_BYTES,
     .idVendor                       = DFU_VENDOR_ID,
     .idProduct                      = DFU_PID,
     .bcdDevice                      = BCD_DEVICE,
@@ -119,4 +119,7 @@ int DFUDeviceRequests(XUD_ep c_ep0_out, NULLABLE_REFERENCE_PARAM(XUD_ep, ep0_in)
 /* Helper function for C */
 void DFUDelay(unsigned d);
 
+/* Returns non-zero while a background download runs in application mode */
+int DFUBackgroundActive(void);
+
 #endif /* _DFU_H_ */
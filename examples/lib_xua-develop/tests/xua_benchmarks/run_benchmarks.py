@@ -0,0 +1,138 @@
+# Copyright 2024 XMOS LIMITED.
+# This Software is subject to the terms of the XMOS Public Licence: Version 1.
+"""
+Runs the xua_benchmarks executables in the simulator and writes the results as JSON.
+
+Each executable prints one line per result:
+
+    BENCH:<name>:<key>=<value>,...:<calls>:<samples>:<ticks>
+
+where <ticks> is the time taken by all the calls in 100MHz reference clock ticks. The results
+are reported in these ticks, as measured, rather than converted to core cycles at an assumed
+core clock.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+from pathlib import Path
+
+REF_CLK_MHZ = 100
+NS_PER_TICK = 1000 // REF_CLK_MHZ
+
+
+def parse_arguments():
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        "--bin-dir",
+        type=Path,
+        default=Path(__file__).parent / "build" / "bin",
+        help="Directory containing the benchmark executables",
+    )
+    parser.add_argument(
+        "--output",
+        type=Path,
+        default=Path("xua_benchmarks.json"),
+        help="JSON output file",
+    )
+    parser.add_argument(
+        "--commit", default=None, help="Commit to record, default is the git HEAD"
+    )
+    return parser.parse_args()
+
+
+def git_commit():
+    try:
+        return subprocess.check_output(
+            ["git", "rev-parse", "HEAD"],
+            text=True,
+            cwd=Path(__file__).parent,
+            stderr=subprocess.DEVNULL,
+        ).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def parse_params(params):
+    parsed = {}
+    for param in filter(None, params.split(",")):
+        key, value = param.split("=")
+        parsed[key] = int(value)
+    return parsed
+
+
+def parse_results(output, config):
+    results = []
+    for line in output.splitlines():
+        if not line.startswith("BENCH:"):
+            continue
+
+        _, name, params, calls, samples, ticks = line.strip().split(":")
+        calls = int(calls)
+        samples = int(samples)
+        ticks = int(ticks)
+
+        results.append(
+            {
+                "name": name,
+                "config": config,
+                "params": parse_params(params),
+                "calls": calls,
+                "ticks_per_call": round(ticks / calls, 1),
+                "ticks_per_sample": round(ticks / samples, 1) if samples else None,
+                "ns_per_call": round(ticks * NS_PER_TICK / calls, 1),
+            }
+        )
+    return results
+
+
+def run_benchmark(xe_path):
+    print("run xsim for executable", xe_path.name)
+    return subprocess.check_output(
+        ["xsim", xe_path], text=True, stderr=subprocess.STDOUT
+    )
+
+
+def main():
+    args = parse_arguments()
+
+    # Executables of the channel count configs are built in a sub-directory per config
+    executables = sorted(args.bin_dir.rglob("*.xe"))
+    if not executables:
+        print("No benchmark executables found in", args.bin_dir, file=sys.stderr)
+        return 1
+
+    results = []
+    for xe_path in executables:
+        config = (
+            xe_path.parent.name if xe_path.parent != args.bin_dir else "default"
+        )
+        try:
+            output = run_benchmark(xe_path)
+        except subprocess.CalledProcessError as e:
+            print(e.output, file=sys.stderr)
+            print("Simulation failed:", xe_path, file=sys.stderr)
+            return 1
+
+        benchmark_results = parse_results(output, config)
+        if not benchmark_results:
+            print("No benchmark output found:", xe_path, file=sys.stderr)
+            return 1
+        results += benchmark_results
+
+    report = {
+        "commit": args.commit if args.commit else git_commit(),
+        "ref_clock_mhz": REF_CLK_MHZ,
+        "results": results,
+    }
+
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+
+    print("Wrote {} results to {}".format(len(results), args.output))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
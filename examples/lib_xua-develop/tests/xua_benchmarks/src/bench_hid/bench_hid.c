@@ -0,0 +1,57 @@
+// Copyright 2024 XMOS LIMITED.
+// This Software is subject to the terms of the XMOS Public Licence: Version 1.
+#include <stddef.h>
+
+#include "xua_benchmarks.h"
+#include "xua_hid_report.h"
+
+/* Uses the HID Report descriptor of the xua_unit_tests test_simple tests */
+#define CONSUMER_CONTROL_PAGE   ( 0x0C )
+#define LOUDNESS_CONTROL        ( 0xE7 )
+
+unsigned sink;
+
+static unsigned construct_usage_header( unsigned size )
+{
+    unsigned header = 0x00;
+
+    header |= ( HID_REPORT_ITEM_USAGE_TAG  << HID_REPORT_ITEM_HDR_TAG_SHIFT  ) & HID_REPORT_ITEM_HDR_TAG_MASK;
+    header |= ( HID_REPORT_ITEM_USAGE_TYPE << HID_REPORT_ITEM_HDR_TYPE_SHIFT ) & HID_REPORT_ITEM_HDR_TYPE_MASK;
+
+    header |= ( size << HID_REPORT_ITEM_HDR_SIZE_SHIFT ) & HID_REPORT_ITEM_HDR_SIZE_MASK;
+
+    return header;
+}
+
+/* Sets the usage of the configurable item at the given location */
+static void bench_set_report_item( unsigned byte, unsigned bit )
+{
+    const unsigned char data[ 1 ] = { LOUDNESS_CONTROL };
+    const unsigned char header = construct_usage_header( sizeof data / sizeof( unsigned char ));
+    unsigned status = 0;
+
+    hidReportInit();
+    hidResetReportDescriptor();
+
+    unsigned start = bench_time();
+    for( unsigned i = 0; i < BENCH_CALLS; ++i ) {
+        status |= hidSetReportItem( 0, byte, bit, CONSUMER_CONTROL_PAGE, header, data );
+    }
+    unsigned ticks = bench_time() - start;
+
+    sink = status;
+
+    bench_begin( "hidSetReportItem" );
+    bench_param( "byte", byte );
+    bench_param( "bit", bit );
+    bench_end( BENCH_CALLS, 0, ticks );
+}
+
+int main( void )
+{
+    /* First and last of the configurable elements */
+    bench_set_report_item( 0, 0 );
+    bench_set_report_item( 1, 7 );
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+// Copyright 2024 XMOS LIMITED.
+// This Software is subject to the terms of the XMOS Public Licence: Version 1.
+#ifndef XUA_BENCHMARKS_H_
+#define XUA_BENCHMARKS_H_
+
+#include "xua_conf.h"
+
+/* Number of calls timed for each result */
+#ifndef BENCH_CALLS
+#define BENCH_CALLS     (256)
+#endif
+
+/* Returns the reference clock time, in 100MHz ticks */
+unsigned bench_time(void);
+
+/* Results are printed on one line each, for run_benchmarks.py to parse:
+ *
+ *   BENCH:<name>:<key>=<value>,...:<calls>:<samples>:<ticks>
+ *
+ * <samples> is the number of audio samples processed by all the calls, 0 if the
+ * function does not process audio, and <ticks> the total time of all the calls. */
+void bench_begin(const char name[]);
+void bench_param(const char key[], int value);
+void bench_end(unsigned calls, unsigned samples, unsigned ticks);
+
+#endif /* XUA_BENCHMARKS_H_ */
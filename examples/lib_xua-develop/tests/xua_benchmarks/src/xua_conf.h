@@ -0,0 +1,42 @@
+// Copyright 2024 XMOS LIMITED.
+// This Software is subject to the terms of the XMOS Public Licence: Version 1.
+
+/* Channel counts are set by the build config, see CMakeLists.txt */
+#ifndef NUM_USB_CHAN_OUT
+#define NUM_USB_CHAN_OUT 2
+#endif
+#ifndef NUM_USB_CHAN_IN
+#define NUM_USB_CHAN_IN 2
+#endif
+#define I2S_CHANS_DAC 2
+#define I2S_CHANS_ADC 2
+#define MCLK_441 (512 * 44100)
+#define MCLK_48 (512 * 48000)
+#define MIN_FREQ 48000
+#define MAX_FREQ 48000
+
+#define EXCLUDE_USB_AUDIO_MAIN
+#define XUA_NUM_PDM_MICS 0
+
+#define PDM_TILE 2
+#define XUD_TILE 1
+#define AUDIO_IO_TILE 1
+
+#define MIXER 1
+#ifndef MIX_INPUTS
+#define MIX_INPUTS (NUM_USB_CHAN_OUT + NUM_USB_CHAN_IN)
+#endif
+
+#define SPDIF_TX_INDEX 0
+#define VENDOR_STR "XMOS"
+#define VENDOR_ID 0x20B1
+#define PRODUCT_STR_A2 "XMOS USB Audio Class"
+#define PRODUCT_STR_A1 "XMOS USB Audio Class"
+#define PID_AUDIO_1 1
+#define PID_AUDIO_2 2
+#define AUDIO_CLASS 2
+#define AUDIO_CLASS_FALLBACK 0
+#define BCD_DEVICE 0x1234
+#define XUA_DFU_EN 0
+
+#define FB_USE_REF_CLOCK 1
@@ -0,0 +1,182 @@
+// Copyright 2024 XMOS LIMITED.
+// This Software is subject to the terms of the XMOS Public Licence: Version 1.
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xua_unit_tests.h"
+
+/* Checks the vector mixer (doMixVpu() in vpumix.S, followed by the shift and saturation
+ * in DoMixes()) against the full mix computed by doMix() in mixer.xc */
+
+#define DEBUG       0
+
+#if     DEBUG
+#define dprintf(...) printf(__VA_ARGS__)
+#else
+#define dprintf(...)
+#endif
+
+#define RANDOM_SEED             55378008
+#define NUM_TESTS_PER_TEST      30
+
+/* Multiplier for a weight of 0dB, see XUA_MIXER_MULT_FRAC_BITS */
+#define MULT_FRAC_BITS          25
+#define MULT_UNITY              (1 << MULT_FRAC_BITS)
+
+/* Laid out as in mixer.xc */
+#define SOURCE_COUNT            (NUM_USB_CHAN_OUT + NUM_USB_CHAN_IN + MAX_MIX_COUNT + 1)
+#define VPU_MIX_CHUNKS          ((SOURCE_COUNT + 7) / 8)
+#define vpu_index(mix, source)  (((((source) / 8) * 8) + (7 - (mix))) * 8 + ((source) % 8))
+
+/* Each product is rounded to 30 fractional bits rather than summed in full, so the top word
+ * of the sum may differ by a quarter of an LSB per source, plus one for the final rounding.
+ * This is the deviation from the full mix documented for XUA_MIXER_VPU */
+#define TOLERANCE               (((VPU_MIX_CHUNKS * 8) / 4 + 1) << 7)
+
+void doMixVpu(volatile int *samples, volatile int *weights, int mixed[8]);
+
+static int samples[VPU_MIX_CHUNKS * 8];
+static int weights[MAX_MIX_COUNT][SOURCE_COUNT];
+static int vpu_weights[VPU_MIX_CHUNKS * 8 * 8];
+
+static unsigned rndm = RANDOM_SEED;
+
+static int sext25(int x)
+{
+    return (int)((unsigned)x << (32 - MULT_FRAC_BITS)) >> (32 - MULT_FRAC_BITS);
+}
+
+/* Same saturation as doMix() */
+static int saturate(int h)
+{
+    if(sext25(h) != h)
+    {
+        if(h < 0)
+            h = (0x80000000>>7);
+        else
+            h = (0x7fffff00>>7);
+    }
+    return h << 7;
+}
+
+/* As doMix(), with every source mapped to one mixer input */
+static int ref_mix(int mix)
+{
+    long long sum = 0;
+
+    for(int i = 0; i < SOURCE_COUNT; i++)
+    {
+        sum += (long long)samples[i] * weights[mix][i];
+    }
+    return saturate((int)(sum >> 32));
+}
+
+static void vpu_mix(int out[MAX_MIX_COUNT])
+{
+    int mixed[8];
+
+    memset(vpu_weights, 0, sizeof(vpu_weights));
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        for(int i = 0; i < SOURCE_COUNT; i++)
+        {
+            vpu_weights[vpu_index(mix, i)] = weights[mix][i];
+        }
+    }
+
+    doMixVpu(samples, vpu_weights, mixed);
+
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        out[mix] = saturate(mixed[mix] >> 2);
+    }
+}
+
+static void check_mixes(void)
+{
+    int out[MAX_MIX_COUNT];
+
+    vpu_mix(out);
+
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        int ref = ref_mix(mix);
+        dprintf("mix %d ref 0x%08x vpu 0x%08x\n", mix, ref, out[mix]);
+        TEST_ASSERT_INT32_WITHIN(TOLERANCE, ref, out[mix]);
+    }
+}
+
+void test_mixer_vpu_unity(void)
+{
+    memset(samples, 0, sizeof(samples));
+    memset(weights, 0, sizeof(weights));
+
+    for(int i = 0; i < SOURCE_COUNT; i++)
+    {
+        samples[i] = (int)random(&rndm);
+    }
+
+    /* Mix n passes source n through unchanged */
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        weights[mix][mix] = MULT_UNITY;
+    }
+
+    check_mixes();
+}
+
+void test_mixer_vpu_random(void)
+{
+    memset(samples, 0, sizeof(samples));
+
+    for(int t = 0; t < NUM_TESTS_PER_TEST; t++)
+    {
+        for(int i = 0; i < SOURCE_COUNT; i++)
+        {
+            samples[i] = (int)random(&rndm);
+        }
+
+        /* Weights up to +/-0dB, so the sums mostly stay in range */
+        for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+        {
+            for(int i = 0; i < SOURCE_COUNT; i++)
+            {
+                weights[mix][i] = (int)random(&rndm) >> (32 - MULT_FRAC_BITS - 1);
+            }
+        }
+
+        check_mixes();
+    }
+}
+
+void test_mixer_vpu_saturation(void)
+{
+    memset(samples, 0, sizeof(samples));
+    memset(weights, 0, sizeof(weights));
+
+    for(int i = 0; i < SOURCE_COUNT; i++)
+    {
+        samples[i] = (i & 1) ? 0x80000000 : 0x7fffffff;
+    }
+
+    /* Even mixes sum the positive full scale sources, odd mixes the negative ones */
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        for(int i = (mix & 1); i < SOURCE_COUNT; i += 2)
+        {
+            weights[mix][i] = MULT_UNITY;
+        }
+    }
+
+    int out[MAX_MIX_COUNT];
+
+    vpu_mix(out);
+
+    for(int mix = 0; mix < MAX_MIX_COUNT; mix++)
+    {
+        int expected = (mix & 1) ? (int)0x80000000 : 0x7fffff00;
+        TEST_ASSERT_EQUAL_INT32(expected, ref_mix(mix));
+        TEST_ASSERT_EQUAL_INT32(expected, out[mix]);
+    }
+}
@@ -5,14 +5,22 @@
 Copyright XMOS Limited - 2018
 """
 
+from __future__ import print_function
+
 import os
 from collections import defaultdict
 import ctypes
 import ctypes.util
 import platform
+import struct
 import sys
 import time
 
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
 """
  Function prototypes to match the c functions defined in xscope_endpoint.h
 """
@@ -28,7 +36,7 @@ RECORD_CALLBACK = ctypes.CFUNCTYPE(
     ctypes.c_ulonglong,     # timestamp
     ctypes.c_uint,          # length
     ctypes.c_ulonglong,     # dataval
-    ctypes.c_char_p)        # databytes
+    ctypes.c_void_p)        # databytes
 
 REGISTER_CALLBACK = ctypes.CFUNCTYPE(
     None,
@@ -47,19 +55,224 @@ STATS_CALLBACK = ctypes.CFUNCTYPE(
     ctypes.c_uint,          # id
     ctypes.c_ulonglong)     # average
 
+"""
+ Probe data types, matching xscope_UserDataType in xscope.h
+"""
+XSCOPE_NONE = 0
+XSCOPE_UINT = 1
+XSCOPE_INT = 2
+XSCOPE_FLOAT = 3
+
+def decode_value(data_type, data_val):
+    """Convert a raw record value into a Python number using the probe data type.
+
+    Signed values are sign extended from 32 or 64 bits, and floating point values
+    are reinterpreted from their single or double precision bit patterns.
+    """
+    if data_type == XSCOPE_INT:
+        if data_val >= (1 << 63):
+            return data_val - (1 << 64)
+        if (1 << 31) <= data_val < (1 << 32):
+            return data_val - (1 << 32)
+    elif data_type == XSCOPE_FLOAT:
+        if data_val < (1 << 32):
+            return struct.unpack('<f', struct.pack('<I', data_val))[0]
+        return struct.unpack('<d', struct.pack('<Q', data_val))[0]
+    return data_val
+
+"""
+ Batch records, as sent by the xscope_batch_* functions in xscope.h
+"""
+BATCH_MAGIC = b'BSX'
+BATCH_HEADER = struct.Struct('<III')  # marker and count, first sample time, last sample time
+BATCH_TICK_UNITS = {'ps': 10000, 'ns': 10, 'us': 0.01}  # probe time units per 100MHz reference tick
+
+def unpack_batch(timestamp, data_bytes, unit):
+    """Split a batch record into individual samples.
+
+    The record timestamp is taken as that of the last sample, and the other
+    samples are spaced evenly back to the first using the reference times in
+    the batch header.
+
+    Returns:
+        List of (timestamp, data_val), or None if this is not a batch record.
+    """
+    if len(data_bytes) < BATCH_HEADER.size or data_bytes[1:4] != BATCH_MAGIC:
+        return None
+    marker, first, last = BATCH_HEADER.unpack_from(data_bytes)
+    count = marker & 0xff
+    if not count or len(data_bytes) < BATCH_HEADER.size + 4 * count:
+        return None
+    values = struct.unpack_from('<{}I'.format(count), data_bytes, BATCH_HEADER.size)
+    span = ((last - first) & 0xffffffff) * BATCH_TICK_UNITS.get(unit, 1)
+    step = float(span) / (count - 1) if count > 1 else 0
+    return [(timestamp - int(step * (count - 1 - i)), v) for i, v in enumerate(values)]
+
+def decode_values(data_type, values):
+    """NumPy equivalent of decode_value for an array of raw uint64 record values."""
+    if data_type == XSCOPE_INT:
+        out = values.view(numpy.int64).copy()
+        out[(values >= (1 << 31)) & (values < (1 << 32))] -= (1 << 32)
+        return out
+    elif data_type == XSCOPE_FLOAT:
+        if values.size and values.max() < (1 << 32):
+            return values.astype(numpy.uint32).view(numpy.float32)
+        return values.view(numpy.float64)
+    return values
+
+def _to_bytes(value):
+    if isinstance(value, bytes):
+        return value
+    return value.encode('utf-8')
+
+def _to_str(value):
+    if isinstance(value, str) or value is None:
+        return value
+    return value.decode('utf-8', 'replace')
+
+class Reducer(object):
+    """Base class for streaming probe reducers.
+
+    A reducer is fed every record of a probe from the endpoint receive thread and
+    returns an aggregate when one is ready, or None otherwise.  Only aggregates are
+    passed on to consumers, so the memory held per probe is bounded by the reducer
+    and not by the length of the capture.
+
+    Windows are closed after `window` samples, or once the timestamp has advanced
+    by `period` (in probe time units) since the first sample of the window,
+    whichever comes first.  Set either to None to disable it.
+    """
+    def __init__(self, window=None, period=None):
+        if not window and not period:
+            raise ValueError('Reducer needs a window or a period')
+        self.window = window
+        self.period = period
+        self._start = None
+        self._count = 0
+        self.reset()
+
+    def reset(self):
+        """Clear the state of the current window."""
+        pass
+
+    def accumulate(self, timestamp, value):
+        """Add a single value to the current window."""
+        raise NotImplementedError
+
+    def result(self):
+        """Return the aggregate for the current window."""
+        raise NotImplementedError
+
+    def update(self, timestamp, value):
+        """Feed one record.  Returns (timestamp, aggregate) when a window closes."""
+        out = None
+        if self.period and self._count and timestamp - self._start >= self.period:
+            out = self.flush()
+        if not self._count:
+            self._start = timestamp
+        self.accumulate(timestamp, value)
+        self._count += 1
+        if self.window and self._count >= self.window:
+            out = self.flush()
+        return out
+
+    def flush(self):
+        """Close the current window.  Returns (timestamp, aggregate) or None if empty."""
+        if not self._count:
+            return None
+        out = (self._start, self.result())
+        self._count = 0
+        self.reset()
+        return out
+
+class WindowStats(Reducer):
+    """Windowed min/max/mean/count.  Aggregates are dicts with those keys."""
+    def reset(self):
+        self._min = None
+        self._max = None
+        self._sum = 0
+
+    def accumulate(self, timestamp, value):
+        if self._min is None or value < self._min:
+            self._min = value
+        if self._max is None or value > self._max:
+            self._max = value
+        self._sum += value
+
+    def result(self):
+        return {'min': self._min,
+                'max': self._max,
+                'mean': float(self._sum) / self._count,
+                'count': self._count}
+
+class Histogram(Reducer):
+    """Windowed histogram over `bins` equal-width bins covering [lo, hi).
+
+    Aggregates are lists of bin counts.  Values outside the range are counted in
+    the first or last bin.
+    """
+    def __init__(self, lo, hi, bins, window=None, period=None):
+        if hi <= lo or bins < 1:
+            raise ValueError('Invalid histogram range')
+        self.lo = lo
+        self.hi = hi
+        self.bins = bins
+        self._scale = float(bins) / (hi - lo)
+        Reducer.__init__(self, window, period)
+
+    def reset(self):
+        self._counts = [0] * self.bins
+
+    def accumulate(self, timestamp, value):
+        idx = int((value - self.lo) * self._scale)
+        self._counts[min(max(idx, 0), self.bins - 1)] += 1
+
+    def result(self):
+        return self._counts
+
+class Decimate(Reducer):
+    """Pass on every `factor`th value unchanged."""
+    def __init__(self, factor):
+        if factor < 1:
+            raise ValueError('Decimation factor must be at least 1')
+        Reducer.__init__(self, window=factor)
+
+    def reset(self):
+        self._first = None
+
+    def accumulate(self, timestamp, value):
+        if self._first is None:
+            self._first = value
+
+    def result(self):
+        return self._first
+
+class _ProbeReducers(object):
+    """Reducers made by `factory` for a consumer of all probes, one per probe name."""
+    def __init__(self, factory):
+        self.factory = factory
+        self.reducers = {}
+
+    def get(self, probe_name):
+        """Return the reducer for a probe, making it on the first record of the probe."""
+        reducer = self.reducers.get(probe_name)
+        if reducer is None:
+            reducer = self.reducers[probe_name] = self.factory()
+        return reducer
+
 class Endpoint(object):
     """Python xSCOPE endpoint wrapper.
 
     Example:
 
         def my_callback(timestamp, probe, value):
-            print '{} {} {}'.format(timestamp, probe, value)
+            print('{} {} {}'.format(timestamp, probe, value))
 
         ep = Endpoint()
 
         try:
             if ep.connect('localhost', '12345'):
-                print "Failed to connect"
+                print("Failed to connect")
             else:
                 ep.consume(callback, 'my_probe")
                 while(True):
@@ -67,28 +280,56 @@ class Endpoint(object):
 
         except KeyboardInterrupt:
             ep.disconnect()
+
+    For high rate probes, construct the endpoint with batching=True and call
+    batch() for those probes.  Their records are then buffered by the native
+    xscope_batch library and collected as NumPy arrays with read_batch() or
+    the async iterator returned by batches(), without a Python call per record.
     """
-    def __init__(self):
+    def __init__(self, batching=False):
         self._probe_info = {}  # probe id to probe info lookup.
                                # probe_info includes name, units, data type, etc...
         self._consumers = defaultdict(set) # probe name -> callbacks lookup
                                            #NOTE: The consumers must be looked up by name and not id because
                                            #      they can be specified before the probe_info is defined
-
-        tool_path = os.environ.get('XMOS_TOOL_PATH')
-        ps = platform.system()
-        if ps == 'Windows':
-            lib_path = os.path.join(tool_path, 'lib', 'xscope_endpoint.dll')
-        else:  # Darwin (aka MacOS) or Linux
-            lib_path = os.path.join(tool_path, 'lib', 'xscope_endpoint.so')
+        self._reducers = defaultdict(list) # probe name -> [(reducer, callback)] lookup
+                                           # '*' -> [(_ProbeReducers, callback)] lookup
+        self._batched = {} # probe name -> batch buffer capacity
+        self._connected = False
+
+        # XSCOPE_ENDPOINT_LIB selects an alternative endpoint library, such as the
+        # capture replaying xscope_mock_endpoint, in place of the tools' one
+        lib_path = os.environ.get('XSCOPE_ENDPOINT_LIB')
+        if not lib_path:
+            tool_path = os.environ.get('XMOS_TOOL_PATH')
+            ps = platform.system()
+            if ps == 'Windows':
+                lib_path = os.path.join(tool_path, 'lib', 'xscope_endpoint.dll')
+            else:  # Darwin (aka MacOS) or Linux
+                lib_path = os.path.join(tool_path, 'lib', 'xscope_endpoint.so')
         self.lib_xscope = ctypes.CDLL(lib_path)
 
+        self.lib_batch = None
+        if batching:
+            batch_path = os.environ.get('XSCOPE_BATCH_LIB') or \
+                os.path.join(os.path.dirname(lib_path),
+                             'xscope_batch.dll' if platform.system() == 'Windows' else 'xscope_batch.so')
+            self.lib_batch = ctypes.CDLL(batch_path)
+            self.lib_batch.xscope_batch_drain.restype = ctypes.c_uint
+            self.lib_batch.xscope_batch_available.restype = ctypes.c_uint
+            self.lib_batch.xscope_batch_dropped.restype = ctypes.c_ulonglong
+
         # create callbacks
         self._print_cb = self._print_callback_func()
         self.lib_xscope.xscope_ep_set_print_cb(self._print_cb)
 
         self._record_cb = self._record_callback_func()
-        self.lib_xscope.xscope_ep_set_record_cb(self._record_cb)
+        if self.lib_batch:
+            # Batched records stay in native code, the rest are forwarded to Python
+            self.lib_batch.xscope_batch_set_forward_cb(self._record_cb)
+            self.lib_xscope.xscope_ep_set_record_cb(self.lib_batch.xscope_batch_record)
+        else:
+            self.lib_xscope.xscope_ep_set_record_cb(self._record_cb)
 
         self._register_cb = self._register_callback_func()
         self.lib_xscope.xscope_ep_set_register_cb(self._register_cb)
@@ -103,6 +344,10 @@ class Endpoint(object):
 
     def _register_callback_func(self):
         def func(id_, type_, r, g, b, name, unit, data_type, data_name):
+            name = _to_str(name)
+            unit = _to_str(unit)
+            if name in self._batched:
+                self._enable_batch(id_, unit, self._batched[name])
             self._probe_info[id_] = {
                 'type': type_,
                 'name': name,
@@ -114,6 +359,7 @@ class Endpoint(object):
 
     def _record_callback_func(self):
         def func(id_, timestamp, length, data_val, data_bytes):
+            data_bytes = ctypes.string_at(data_bytes, length) if length else None
             self.on_record(id_, timestamp, length, data_val, data_bytes)
         return RECORD_CALLBACK(func)
 
@@ -127,24 +373,36 @@ class Endpoint(object):
         """xScope printf handler.
            Override this to method to implement your own printing or to silence the printout.
         """
-        print data.rstrip()
+        print(_to_str(data.rstrip()))
 
     def on_register(self, id_, type_, name, unit, data_type):
         """Server probe registration handler.
            Override this to method to implement your own registration or to silence the printout.
         """
-        print 'Probe registered: id={}, type={}, name={}, unit={}, data_type={}'.format(id_, type_, name, unit, data_type)
+        print('Probe registered: id={}, type={}, name={}, unit={}, data_type={}'.format(id_, type_, name, unit, data_type))
 
     def on_record(self, id_, timestamp, length, data_val, data_bytes):
         """Server record handler.  Will dispatch to probe consumer callback.
            Override this to method to implement your own dispatcher.  However,
            that should rarely be necessary.
+           Batch records are unpacked and dispatched one sample at a time.
         """
+        probe_info = self._probe_info[id_]
+
+        if length:
+            samples = unpack_batch(timestamp, data_bytes[0:length], probe_info.get('unit'))
+            if samples is not None:
+                for sample_timestamp, sample_val in samples:
+                    self._dispatch(probe_info, sample_timestamp, sample_val)
+                return
+
+        self._dispatch(probe_info, timestamp, data_val)
+
+    def _dispatch(self, probe_info, timestamp, data_val):
         def notify_consumers(consumers, probe_name):
             for cb in consumers:
                 cb(timestamp, probe_name, data_val)
 
-        probe_info = self._probe_info[id_]
         probe_name =  probe_info['name']
 
         if probe_name in self._consumers:
@@ -152,6 +410,15 @@ class Endpoint(object):
         if '*' in self._consumers:
             notify_consumers(self._consumers['*'], probe_name)
 
+        if probe_name in self._reducers or '*' in self._reducers:
+            value = decode_value(probe_info['data_type'], data_val)
+            reducers = list(self._reducers.get(probe_name, ()))
+            reducers += [(probe_reducers.get(probe_name), cb) for probe_reducers, cb in self._reducers.get('*', ())]
+            for reducer, cb in reducers:
+                out = reducer.update(timestamp, value)
+                if out is not None:
+                    cb(out[0], probe_name, out[1])
+
     def connect(self, hostname='localhost', port='10234'):
         """Connect to xSCOPE server
 
@@ -163,25 +430,124 @@ class Endpoint(object):
             0 for success
             1 for failure
         """
-        return self.lib_xscope.xscope_ep_connect(hostname, port)
+        ret = self.lib_xscope.xscope_ep_connect(_to_bytes(hostname), _to_bytes(port))
+        self._connected = (ret == 0)
+        return ret
 
     def disconnect(self):
         """Disconnect from xSCOPE server
         """
+        self._connected = False
         self.lib_xscope.xscope_ep_disconnect()
 
-    def consume(self, callback, probe_name=None):
+    def consume(self, callback, probe_name=None, reducer=None):
         """Consume a probe by name.
 
         Note:
-            Set probe=None to consume all probes.
+            Set probe=None to consume all probes.  The reducer for all probes must
+            be a factory, such as a Reducer subclass or a lambda returning a Reducer,
+            which is called to make a separate reducer for each probe on its first
+            record.
 
         Args:
             callback (callable): Callback function with signature (timestamp, probe, value).
             probe_name (str): Probe name
+            reducer (Reducer or callable): Optional reducer, or factory returning one.  If
+                               given, the callback receives the aggregate of each window
+                               instead of every record.
         """
         probe_name = probe_name or '*'
-        self._consumers[probe_name].add(callback)
+        if reducer is None:
+            self._consumers[probe_name].add(callback)
+        elif probe_name != '*':
+            if not isinstance(reducer, Reducer):
+                reducer = reducer()
+            self._reducers[probe_name].append((reducer, callback))
+        elif isinstance(reducer, Reducer):
+            raise TypeError('A reducer for all probes must be a factory, one reducer is made per probe')
+        else:
+            self._reducers[probe_name].append((_ProbeReducers(reducer), callback))
+
+    def flush(self):
+        """Deliver the aggregates of any partially filled reducer windows."""
+        for probe_name, reducers in self._reducers.items():
+            for reducer, cb in reducers:
+                if probe_name == '*':
+                    # Flushed under the name of the probe each reducer was made for
+                    named = list(reducer.reducers.items())
+                else:
+                    named = [(probe_name, reducer)]
+                for name, r in named:
+                    out = r.flush()
+                    if out is not None:
+                        cb(out[0], name, out[1])
+
+    def batch(self, probe_name, capacity=1 << 20):
+        """Buffer the records of a probe natively, for collection with read_batch().
+
+        Records of batched probes are not passed to consumers.  This should be
+        called before connecting so that no records are missed.
+
+        Args:
+            probe_name (str): Probe name
+            capacity (int): Number of records buffered before records are dropped
+        """
+        if not self.lib_batch:
+            raise RuntimeError('Endpoint was not created with batching=True')
+        self._batched[probe_name] = capacity
+        for id_, info in list(self._probe_info.items()):
+            if info['name'] == probe_name:
+                self._enable_batch(id_, info['unit'], capacity)
+
+    def _enable_batch(self, id_, unit, capacity):
+        self.lib_batch.xscope_batch_enable(id_, capacity)
+        self.lib_batch.xscope_batch_set_timebase(id_, ctypes.c_double(BATCH_TICK_UNITS.get(unit, 1)))
+
+    def read_batch(self, probe_names=None):
+        """Collect the records buffered for batched probes.
+
+        Args:
+            probe_names (list): Probe names, or None for all batched probes.
+
+        Returns:
+            dict of probe name -> (timestamps, values) NumPy arrays for each probe
+            with new records.  Values are decoded using the probe data type.
+        """
+        batches = {}
+        for id_, info in list(self._probe_info.items()):
+            name = info['name']
+            if name not in self._batched or (probe_names is not None and name not in probe_names):
+                continue
+            count = self.lib_batch.xscope_batch_available(id_)
+            if not count:
+                continue
+            timestamps = numpy.empty(count, dtype=numpy.uint64)
+            values = numpy.empty(count, dtype=numpy.uint64)
+            count = self.lib_batch.xscope_batch_drain(id_,
+                                                      timestamps.ctypes.data_as(ctypes.c_void_p),
+                                                      values.ctypes.data_as(ctypes.c_void_p),
+                                                      count)
+            batches[name] = (timestamps[:count], decode_values(info['data_type'], values[:count]))
+        return batches
+
+    def dropped(self, probe_name):
+        """Return the number of records of a batched probe dropped because its buffer was full."""
+        return sum(self.lib_batch.xscope_batch_dropped(id_)
+                   for id_, info in list(self._probe_info.items()) if info['name'] == probe_name)
+
+    def batches(self, probe_names=None, interval=0.005):
+        """Async iterator over read_batch() results.
+
+        Example:
+
+            async for batch in ep.batches(['my_probe']):
+                timestamps, values = batch['my_probe']
+
+        Args:
+            probe_names (list): Probe names, or None for all batched probes.
+            interval (float): Seconds between polls of the native buffers while empty.
+        """
+        return BatchIterator(self, probe_names, interval)
 
     def publish(self, data):
         """Publish message to endpoint.
@@ -193,7 +559,36 @@ class Endpoint(object):
           0 for success
           1 for failure
         """
-        return self.lib_xscope.xscope_ep_request_upload(ctypes.c_uint(len(data)+1), ctypes.c_char_p(data))
+        return self.lib_xscope.xscope_ep_request_upload(ctypes.c_uint(len(data)+1), ctypes.c_char_p(_to_bytes(data)))
+
+class BatchIterator(object):
+    """Async iterator yielding non-empty read_batch() results until disconnect."""
+    def __init__(self, endpoint, probe_names, interval):
+        self._endpoint = endpoint
+        self._probe_names = probe_names
+        self._interval = interval
+
+    def __aiter__(self):
+        return self
+
+    def __anext__(self):
+        import asyncio
+        loop = asyncio.get_event_loop()
+        future = loop.create_future()
+
+        def poll():
+            if future.cancelled():
+                return
+            batch = self._endpoint.read_batch(self._probe_names)
+            if batch:
+                future.set_result(batch)
+            elif not self._endpoint._connected:
+                future.set_exception(StopAsyncIteration())
+            else:
+                loop.call_later(self._interval, poll)
+
+        poll()
+        return future
 
 if __name__ == '__main__':
     import argparse
@@ -202,15 +597,25 @@ if __name__ == '__main__':
     parser.add_argument('--port', default='10234', help='Port')
     parser.add_argument('-c', '--consume', nargs='?', action='append', default=[], help='Probe names to consume (omit to consume all)')
     parser.add_argument('-p', '--publish', default=None, help='Message to publish')
+    parser.add_argument('-w', '--window', type=int, default=None, help='Print min/max/mean/count over windows of this many samples')
+    parser.add_argument('-d', '--decimate', type=int, default=None, help='Print only every Nth sample')
     args = parser.parse_args()
 
     def test_callback(timestamp, probe_name, value):
-        print '{} {} {}'.format(timestamp, probe_name, value)
+        print('{} {} {}'.format(timestamp, probe_name, value))
+
+    def make_reducer():
+        # Returns a factory, so that consuming all probes gives each probe its own reducer
+        if args.window:
+            return lambda: WindowStats(window=args.window)
+        if args.decimate:
+            return lambda: Decimate(args.decimate)
+        return None
 
     ep = Endpoint()
     try:
         if ep.connect(args.host, args.port):
-            print "Failed to connect"
+            print("Failed to connect")
             sys.exit(1)
 
         if args.publish:
@@ -218,12 +623,13 @@ if __name__ == '__main__':
 
         if args.consume:
             for probe in args.consume:
-                ep.consume(test_callback, probe)
+                ep.consume(test_callback, probe, make_reducer())
         else:
-            ep.consume(test_callback)
+            ep.consume(test_callback, reducer=make_reducer())
 
         while(True):
             # Release the CPU
             time.sleep(1)
     except KeyboardInterrupt:
+        ep.flush()
         ep.disconnect()
@@ -0,0 +1,336 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Copyright XMOS Limited - 2018
+"""
+
+from __future__ import print_function
+
+import json
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+import xscope
+
+"""
+ Local proxy wire format.
+
+ Every message is a header of (type, payload length) followed by the payload.
+ Proxy -> subscriber:
+   MSG_REGISTER  JSON object with the probe registration
+   MSG_RECORD    (id, timestamp, value) followed by the record data bytes, if any
+   MSG_PRINT     (timestamp) followed by the printed bytes
+ Subscriber -> proxy:
+   MSG_SUBSCRIBE newline separated probe names, empty for all probes
+   MSG_PUBLISH   bytes to upload to the target
+"""
+MSG_REGISTER = 1
+MSG_RECORD = 2
+MSG_PRINT = 3
+MSG_SUBSCRIBE = 4
+MSG_PUBLISH = 5
+
+HEADER = struct.Struct('<BI')
+RECORD = struct.Struct('<IQQ')
+PRINT = struct.Struct('<Q')
+
+DEFAULT_SOCKET = '/tmp/xscope_proxy.sock'
+
+def _recv_exact(sock, length):
+    data = b''
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+def recv_message(sock):
+    """Read one message from a proxy socket.  Returns (type, payload)."""
+    type_, length = HEADER.unpack(_recv_exact(sock, HEADER.size))
+    return type_, _recv_exact(sock, length)
+
+def send_message(sock, type_, payload=b''):
+    sock.sendall(HEADER.pack(type_, len(payload)) + payload)
+
+def _as_str(value):
+    if isinstance(value, bytes):
+        return value.decode('utf-8', 'replace')
+    return value
+
+class Subscriber(object):
+    """A connected local client of the proxy.
+
+    Messages are queued and written by a dedicated thread so that a slow client
+    never stalls the upstream receive thread.  When the queue is full, messages
+    for this client are dropped and counted.
+    """
+    def __init__(self, proxy, sock, max_queue):
+        self.proxy = proxy
+        self.sock = sock
+        self.probes = None  # None means all probes
+        self.dropped = 0
+        self._queue = queue.Queue(max_queue)
+        self._writer = threading.Thread(target=self._write_loop)
+        self._writer.daemon = True
+        self._reader = threading.Thread(target=self._read_loop)
+        self._reader.daemon = True
+
+    def start(self):
+        self._writer.start()
+        self._reader.start()
+
+    def wants(self, probe_name):
+        return self.probes is None or probe_name in self.probes
+
+    def post(self, type_, payload):
+        try:
+            self._queue.put_nowait((type_, payload))
+        except queue.Full:
+            self.dropped += 1
+
+    def close(self):
+        # Close the socket first so a writer blocked in send wakes up, then wake
+        # an idle writer.  When the queue is full the writer is not idle and
+        # stops on its next send instead.
+        self.proxy.remove(self)
+        try:
+            self.sock.close()
+        except socket.error:
+            pass
+        try:
+            self._queue.put_nowait(None)
+        except queue.Full:
+            pass
+
+    def _write_loop(self):
+        while True:
+            msg = self._queue.get()
+            if msg is None:
+                return
+            try:
+                send_message(self.sock, *msg)
+            except socket.error:
+                self.close()
+                return
+
+    def _read_loop(self):
+        try:
+            while True:
+                type_, payload = recv_message(self.sock)
+                if type_ == MSG_SUBSCRIBE:
+                    names = [n for n in payload.decode('utf-8').split('\n') if n]
+                    self.probes = set(names) if names else None
+                elif type_ == MSG_PUBLISH:
+                    self.proxy.publish(payload)
+        except (EOFError, socket.error):
+            self.close()
+
+class Proxy(xscope.Endpoint):
+    """xSCOPE fan-out proxy.
+
+    Holds the single upstream connection to the xSCOPE server and re-publishes
+    probe registrations, records and prints to any number of local subscribers
+    connected over a Unix domain socket.  Each subscriber may restrict the probes
+    it receives, and late subscribers are sent all registrations seen so far.
+    """
+    def __init__(self, path=DEFAULT_SOCKET, max_queue=65536):
+        xscope.Endpoint.__init__(self)
+        self.path = path
+        self.max_queue = max_queue
+        self._lock = threading.Lock()
+        self._subscribers = []
+        self._registrations = []
+        self._upload_lock = threading.Lock()
+        self._listener = None
+
+    def listen(self):
+        """Open the local socket and accept subscribers on a background thread."""
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        self._listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._listener.bind(self.path)
+        self._listener.listen(16)
+        thread = threading.Thread(target=self._accept_loop)
+        thread.daemon = True
+        thread.start()
+
+    def close(self):
+        if self._listener:
+            self._listener.close()
+            self._listener = None
+            os.unlink(self.path)
+        with self._lock:
+            subscribers = list(self._subscribers)
+        for sub in subscribers:
+            sub.close()
+
+    def remove(self, sub):
+        with self._lock:
+            if sub in self._subscribers:
+                self._subscribers.remove(sub)
+
+    def publish(self, data):
+        # Uploads from subscribers are serialised, and sent as Endpoint.publish() would
+        with self._upload_lock:
+            return xscope.Endpoint.publish(self, data)
+
+    def _accept_loop(self):
+        while self._listener:
+            try:
+                conn, _ = self._listener.accept()
+            except socket.error:
+                return
+            sub = Subscriber(self, conn, self.max_queue)
+            with self._lock:
+                for payload in self._registrations:
+                    sub.post(MSG_REGISTER, payload)
+                self._subscribers.append(sub)
+            sub.start()
+
+    def on_register(self, id_, type_, name, unit, data_type):
+        payload = json.dumps({'id': id_, 'type': type_, 'name': _as_str(name),
+                              'unit': _as_str(unit), 'data_type': data_type}).encode('utf-8')
+        with self._lock:
+            self._registrations.append(payload)
+            for sub in self._subscribers:
+                sub.post(MSG_REGISTER, payload)
+
+    def on_record(self, id_, timestamp, length, data_val, data_bytes):
+        probe_name = self._probe_info[id_]['name']
+        payload = RECORD.pack(id_, timestamp, data_val)
+        if length:
+            payload += data_bytes[0:length]
+        with self._lock:
+            for sub in self._subscribers:
+                if sub.wants(probe_name):
+                    sub.post(MSG_RECORD, payload)
+
+    def on_print(self, timestamp, data):
+        payload = PRINT.pack(timestamp) + data
+        with self._lock:
+            for sub in self._subscribers:
+                sub.post(MSG_PRINT, payload)
+
+    def dropped(self):
+        """Return {subscriber index: dropped message count} for all subscribers."""
+        with self._lock:
+            return dict((i, s.dropped) for i, s in enumerate(self._subscribers))
+
+class ProxyEndpoint(xscope.Endpoint):
+    """Endpoint which receives from a local Proxy instead of the xSCOPE server.
+
+    This has the same consume/publish interface as Endpoint, so existing
+    consumers and reducers work unchanged.  Only the probes that have consumers
+    at connection time are requested from the proxy.  Batching is not supported,
+    the records arrive one at a time over the proxy socket.
+    """
+    def __init__(self):
+        # Deliberately does not load the endpoint library, so sets up the rest of
+        # the Endpoint state itself
+        self._probe_info = {}
+        self._consumers = xscope.defaultdict(set)
+        self._reducers = xscope.defaultdict(list)
+        self._batched = {}
+        self._connected = False
+        self.lib_batch = None
+        self._sock = None
+        self._thread = None
+
+    def connect(self, path=DEFAULT_SOCKET):
+        """Connect to the proxy socket.
+
+        Returns:
+            0 for success
+            1 for failure
+        """
+        try:
+            self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self._sock.connect(path)
+            names = [] if '*' in self._consumers or '*' in self._reducers \
+                else set(self._consumers) | set(self._reducers)
+            send_message(self._sock, MSG_SUBSCRIBE, '\n'.join(names).encode('utf-8'))
+        except socket.error:
+            self._sock = None
+            return 1
+        self._connected = True
+        self._thread = threading.Thread(target=self._receive_loop, args=(self._sock,))
+        self._thread.daemon = True
+        self._thread.start()
+        return 0
+
+    def disconnect(self):
+        self._connected = False
+        if self._sock:
+            # Wakes the receive thread, which then sees the end of the stream
+            try:
+                self._sock.shutdown(socket.SHUT_RDWR)
+            except socket.error:
+                pass
+            self._sock.close()
+            self._sock = None
+
+    def batch(self, probe_name, capacity=1 << 20):
+        """Not supported by the proxy, raises RuntimeError."""
+        raise RuntimeError('ProxyEndpoint does not support batching')
+
+    def publish(self, data):
+        if not self._sock:
+            return 1
+        try:
+            send_message(self._sock, MSG_PUBLISH, data)
+        except socket.error:
+            return 1
+        return 0
+
+    def _receive_loop(self, sock):
+        try:
+            while True:
+                type_, payload = recv_message(sock)
+                if type_ == MSG_REGISTER:
+                    info = json.loads(payload.decode('utf-8'))
+                    self._probe_info[info['id']] = info
+                    self.on_register(info['id'], info['type'], info['name'], info['unit'], info['data_type'])
+                elif type_ == MSG_RECORD:
+                    id_, timestamp, data_val = RECORD.unpack_from(payload)
+                    data_bytes = payload[RECORD.size:]
+                    self.on_record(id_, timestamp, len(data_bytes), data_val, data_bytes)
+                elif type_ == MSG_PRINT:
+                    (timestamp,) = PRINT.unpack_from(payload)
+                    self.on_print(timestamp, payload[PRINT.size:])
+        except (EOFError, socket.error):
+            pass
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser('xSCOPE multi-client proxy')
+    parser.add_argument('--host', default='localhost', help='Hostname of the xSCOPE server')
+    parser.add_argument('--port', default='10234', help='Port of the xSCOPE server')
+    parser.add_argument('-s', '--socket', default=DEFAULT_SOCKET, help='Path of the local subscriber socket')
+    parser.add_argument('-q', '--max-queue', type=int, default=65536, help='Messages buffered per subscriber before dropping')
+    args = parser.parse_args()
+
+    proxy = Proxy(args.socket, args.max_queue)
+    proxy.listen()
+    try:
+        if proxy.connect(args.host, args.port):
+            print("Failed to connect")
+            proxy.close()
+            sys.exit(1)
+
+        while(True):
+            # Release the CPU
+            time.sleep(1)
+    except KeyboardInterrupt:
+        proxy.disconnect()
+        proxy.close()
@@ -0,0 +1,17 @@
+TOOLS_ROOT = ../../..
+include $(TOOLS_ROOT)/src/MakefileMac.mak
+
+OBJS = XScopeBatch.o
+CPPFLAGS_LOCAL = -std=c++11
+
+all: $(DLLDIR)/xscope_batch.so
+
+$(DLLDIR)/xscope_batch.so: $(OBJS)
+	$(CCPP) $(OBJS) -dynamiclib -o $(DLLDIR)/xscope_batch.so $(EXTRALIBS)
+
+%.o: %.cpp
+	$(CPP) $(CPPFLAGS) -c $< -o $@ -I$(TOOLS_ROOT)/include
+
+clean: 
+	rm -rf $(OBJS)
+	rm -rf $(DLLDIR)/xscope_batch.*
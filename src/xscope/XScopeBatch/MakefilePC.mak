@@ -0,0 +1,20 @@
+TOOLS_ROOT = ../../..
+!INCLUDE $(TOOLS_ROOT)/src/MakefilePc.mak
+
+OBJS = XScopeBatch.obj
+
+all: $(DLLDIR)/xscope_batch.dll
+
+"$(DLLDIR)/xscope_batch.dll": $(OBJS)
+    $(LINK32) $(LINK32_LIBS) /DLL /nologo /out:"$(DLLDIR)/xscope_batch.dll" @<<
+    $(LINKFLAGS) $(OBJS)
+<<
+
+.cpp{}.obj::
+    $(CPP) @<<
+    $(CFLAGS) -I$(TOOLS_ROOT)/include $<
+<<
+
+clean:
+    -@rm $(OBJS) *.idb *.pdb 2> NUL
+    -@rm $(DLLDIR)/xscope_batch.* 2> NUL
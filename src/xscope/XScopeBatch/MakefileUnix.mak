@@ -0,0 +1,17 @@
+TOOLS_ROOT = ../../..
+include $(TOOLS_ROOT)/src/MakefileUnix.mak
+
+OBJS = XScopeBatch.o
+CPPFLAGS_LOCAL = -std=c++11
+
+all: $(DLLDIR)/xscope_batch$(DLLEXT)
+
+$(DLLDIR)/xscope_batch$(DLLEXT): $(OBJS)
+	$(CCPP) $(OBJS) -shared -o $(DLLDIR)/xscope_batch$(DLLEXT) $(LIBS) $(EXTRALIBS)
+
+%.o: %.cpp
+	$(CPP) $(CPPFLAGS) -c $< -o $@ -I$(TOOLS_ROOT)/include
+
+clean: 
+	rm -rf $(OBJS)
+	rm -rf $(DLLDIR)/xscope_batch.*
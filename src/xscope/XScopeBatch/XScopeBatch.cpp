@@ -0,0 +1,199 @@
+/*
+ * Copyright XMOS Limited - 2024
+ *
+ * Native record batching for xSCOPE host programs.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include "XScopeBatch.h"
+
+// Probe IDs are 8 bits on the target
+#define MAX_PROBES 256
+
+// Batch record layout, see xscope_batch_* in the target xscope.h
+#define BATCH_HEADER_BYTES 12
+
+/*
+ * Types
+ */
+struct ProbeBuffer
+{
+  unsigned capacity;
+  unsigned long long *timestamps;
+  unsigned long long *values;
+  double units_per_tick;
+  std::atomic<unsigned> head;  // Written by the producer only
+  std::atomic<unsigned> tail;  // Written by the consumer only
+  std::atomic<unsigned long long> dropped;
+};
+
+/*
+ * Static data
+ */
+static std::atomic<ProbeBuffer *> s_buffers[MAX_PROBES];
+static std::atomic<xscope_ep_record_fptr> s_forward(0);
+
+/*
+ * Static functions
+ */
+static void push(ProbeBuffer *buf, unsigned long long timestamp, unsigned long long dataval);
+
+static unsigned read_u32(const unsigned char *p)
+{
+  return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/*
+ * Returns false if the record is not a batch record
+ */
+static bool unpack_batch(ProbeBuffer *buf, unsigned long long timestamp, unsigned int length,
+                         const unsigned char *databytes)
+{
+  if (length < BATCH_HEADER_BYTES || memcmp(databytes + 1, "BSX", 3) != 0)
+    return false;
+
+  unsigned count = databytes[0];
+  if (count == 0 || length < BATCH_HEADER_BYTES + 4 * count)
+    return false;
+
+  // The record is timestamped with the last sample, the rest are spaced evenly before it
+  unsigned span = read_u32(databytes + 8) - read_u32(databytes + 4);
+  double step = count > 1 ? span * buf->units_per_tick / (count - 1) : 0;
+  for (unsigned i = 0; i < count; i++) {
+    unsigned long long sample_timestamp = timestamp - (unsigned long long)(step * (count - 1 - i));
+    push(buf, sample_timestamp, read_u32(databytes + BATCH_HEADER_BYTES + 4 * i));
+  }
+  return true;
+}
+
+/*
+ * Record
+ */
+void xscope_batch_record(unsigned int id, unsigned long long timestamp, unsigned int length,
+                         unsigned long long dataval, unsigned char *databytes)
+{
+  ProbeBuffer *buf = id < MAX_PROBES ? s_buffers[id].load(std::memory_order_acquire) : 0;
+  if (!buf) {
+    xscope_ep_record_fptr forward = s_forward.load(std::memory_order_relaxed);
+    if (forward)
+      forward(id, timestamp, length, dataval, databytes);
+    return;
+  }
+
+  if (length && unpack_batch(buf, timestamp, length, databytes))
+    return;
+  push(buf, timestamp, dataval);
+}
+
+static void push(ProbeBuffer *buf, unsigned long long timestamp, unsigned long long dataval)
+{
+  unsigned head = buf->head.load(std::memory_order_relaxed);
+  unsigned next = head + 1 == buf->capacity ? 0 : head + 1;
+  if (next == buf->tail.load(std::memory_order_acquire)) {
+    buf->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buf->timestamps[head] = timestamp;
+  buf->values[head] = dataval;
+  buf->head.store(next, std::memory_order_release);
+}
+
+void xscope_batch_set_forward_cb(xscope_ep_record_fptr forward)
+{
+  s_forward.store(forward, std::memory_order_relaxed);
+}
+
+/*
+ * Enable
+ */
+int xscope_batch_enable(unsigned int id, unsigned int capacity)
+{
+  if (id >= MAX_PROBES || capacity == 0)
+    return XSCOPE_EP_FAILURE;
+  if (s_buffers[id].load())
+    return XSCOPE_EP_SUCCESS;
+
+  ProbeBuffer *buf = new (std::nothrow) ProbeBuffer;
+  if (!buf)
+    return XSCOPE_EP_FAILURE;
+
+  // One slot is kept free to tell a full buffer from an empty one
+  buf->capacity = capacity + 1;
+  buf->timestamps = (unsigned long long *)malloc(buf->capacity * sizeof(unsigned long long));
+  buf->values = (unsigned long long *)malloc(buf->capacity * sizeof(unsigned long long));
+  if (!buf->timestamps || !buf->values) {
+    free(buf->timestamps);
+    free(buf->values);
+    delete buf;
+    return XSCOPE_EP_FAILURE;
+  }
+  buf->units_per_tick = 1;
+  buf->head = 0;
+  buf->tail = 0;
+  buf->dropped = 0;
+  s_buffers[id].store(buf, std::memory_order_release);
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_batch_set_timebase(unsigned int id, double units_per_tick)
+{
+  ProbeBuffer *buf = id < MAX_PROBES ? s_buffers[id].load(std::memory_order_acquire) : 0;
+  if (!buf)
+    return XSCOPE_EP_FAILURE;
+  buf->units_per_tick = units_per_tick;
+  return XSCOPE_EP_SUCCESS;
+}
+
+/*
+ * Drain
+ */
+unsigned int xscope_batch_drain(unsigned int id, unsigned long long *timestamps,
+                                unsigned long long *values, unsigned int max_records)
+{
+  ProbeBuffer *buf = id < MAX_PROBES ? s_buffers[id].load(std::memory_order_acquire) : 0;
+  if (!buf)
+    return 0;
+
+  unsigned tail = buf->tail.load(std::memory_order_relaxed);
+  unsigned head = buf->head.load(std::memory_order_acquire);
+  unsigned count = 0;
+
+  // Copy in at most two contiguous runs
+  while (tail != head && count < max_records) {
+    unsigned end = head > tail ? head : buf->capacity;
+    unsigned run = end - tail;
+    if (run > max_records - count)
+      run = max_records - count;
+    for (unsigned i = 0; i < run; i++) {
+      timestamps[count + i] = buf->timestamps[tail + i];
+      values[count + i] = buf->values[tail + i];
+    }
+    count += run;
+    tail += run;
+    if (tail == buf->capacity)
+      tail = 0;
+  }
+
+  buf->tail.store(tail, std::memory_order_release);
+  return count;
+}
+
+unsigned int xscope_batch_available(unsigned int id)
+{
+  ProbeBuffer *buf = id < MAX_PROBES ? s_buffers[id].load(std::memory_order_acquire) : 0;
+  if (!buf)
+    return 0;
+  unsigned head = buf->head.load(std::memory_order_acquire);
+  unsigned tail = buf->tail.load(std::memory_order_relaxed);
+  return head >= tail ? head - tail : buf->capacity - tail + head;
+}
+
+unsigned long long xscope_batch_dropped(unsigned int id)
+{
+  ProbeBuffer *buf = id < MAX_PROBES ? s_buffers[id].load(std::memory_order_acquire) : 0;
+  return buf ? buf->dropped.load(std::memory_order_relaxed) : 0;
+}
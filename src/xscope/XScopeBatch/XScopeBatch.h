@@ -0,0 +1,93 @@
+/*
+ * Copyright XMOS Limited - 2024
+ *
+ * Native record batching for xSCOPE host programs.
+ *
+ * xscope_batch_record can be registered directly as the endpoint record
+ * callback. Records of probes enabled with xscope_batch_enable are appended
+ * to a per-probe ring buffer of timestamps and values without leaving native
+ * code, and are collected in bulk with xscope_batch_drain. Records of other
+ * probes are passed on to the forward callback, if one is set. Batch records
+ * sent by the xscope_batch_* target functions are unpacked into one entry per
+ * sample.
+ *
+ * Each probe buffer has a single producer (the endpoint receive thread) and a
+ * single consumer. When a buffer is full new records are dropped and counted.
+ *
+ */
+
+#ifndef _XScopeBatch_H_
+#define _XScopeBatch_H_
+
+#include "xscope_endpoint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Record callback to register with xscope_ep_set_record_cb.
+ */
+XSCOPE_EP_DLL_EXPORT void xscope_batch_record(unsigned int id,
+                                              unsigned long long timestamp,
+                                              unsigned int length,
+                                              unsigned long long dataval,
+                                              unsigned char *databytes);
+
+/**
+ * Set the callback for records of probes which are not batched.
+ *
+ * @param forward Callback, or null to discard such records
+ */
+XSCOPE_EP_DLL_EXPORT void xscope_batch_set_forward_cb(xscope_ep_record_fptr forward);
+
+/**
+ * Start batching records of a probe.
+ *
+ * @param id  Probe ID as given to the registration callback
+ * @param capacity  Number of records buffered before records are dropped
+ * @retval XSCOPE_EP_SUCCESS Success
+ * @retval XSCOPE_EP_FAILURE Failure, such as invalid ID or out of memory
+ */
+XSCOPE_EP_DLL_EXPORT int xscope_batch_enable(unsigned int id, unsigned int capacity);
+
+/**
+ * Set the probe time units per 100MHz reference clock tick, used to space
+ * the timestamps of samples unpacked from batch records. Defaults to 1.
+ *
+ * @param id  Probe ID
+ * @param units_per_tick  e.g. 10000 for a probe with 'ps' time units
+ * @retval XSCOPE_EP_SUCCESS Success
+ * @retval XSCOPE_EP_FAILURE Failure, such as probe not enabled
+ */
+XSCOPE_EP_DLL_EXPORT int xscope_batch_set_timebase(unsigned int id, double units_per_tick);
+
+/**
+ * Copy up to max_records buffered records of a probe out of its buffer.
+ *
+ * @param id  Probe ID
+ * @param timestamps  Buffer for at least max_records timestamps
+ * @param values  Buffer for at least max_records values
+ * @param max_records  Maximum number of records to copy
+ * @return Number of records copied
+ */
+XSCOPE_EP_DLL_EXPORT unsigned int xscope_batch_drain(unsigned int id,
+                                                     unsigned long long *timestamps,
+                                                     unsigned long long *values,
+                                                     unsigned int max_records);
+
+/**
+ * Return the number of records currently buffered for a probe.
+ */
+XSCOPE_EP_DLL_EXPORT unsigned int xscope_batch_available(unsigned int id);
+
+/**
+ * Return the number of records dropped for a probe because its buffer was full.
+ */
+XSCOPE_EP_DLL_EXPORT unsigned long long xscope_batch_dropped(unsigned int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _XScopeBatch_H_ */
@@ -0,0 +1,22 @@
+TOOLS_ROOT = ../../..
+include $(TOOLS_ROOT)/src/MakefileMac.mak
+
+MOCK_OBJS = XScopeMock.o
+CAPTURE_OBJS = XScopeCapture.o
+CPPFLAGS_LOCAL = -std=c++11
+
+all: $(DLLDIR)/xscope_mock_endpoint.so $(BINDIR)/xscope_capture
+
+$(DLLDIR)/xscope_mock_endpoint.so: $(MOCK_OBJS)
+	$(CCPP) $(MOCK_OBJS) -dynamiclib -o $(DLLDIR)/xscope_mock_endpoint.so $(EXTRALIBS)
+
+$(BINDIR)/xscope_capture: $(CAPTURE_OBJS)
+	$(CPP) $(CAPTURE_OBJS) -o $(BINDIR)/xscope_capture $(TOOLS_ROOT)/lib/xscope_endpoint.so $(EXTRALIBS)
+
+%.o: %.cpp
+	$(CPP) $(CPPFLAGS) -c $< -o $@ -I$(TOOLS_ROOT)/include
+
+clean: 
+	rm -rf $(MOCK_OBJS) $(CAPTURE_OBJS)
+	rm -rf $(DLLDIR)/xscope_mock_endpoint.*
+	rm -rf $(BINDIR)/xscope_capture
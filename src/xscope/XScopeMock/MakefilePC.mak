@@ -0,0 +1,28 @@
+TOOLS_ROOT = ../../..
+!INCLUDE $(TOOLS_ROOT)/src/MakefilePc.mak
+
+MOCK_OBJS = XScopeMock.obj
+CAPTURE_OBJS = XScopeCapture.obj
+
+all: $(DLLDIR)/xscope_mock_endpoint.dll $(BINDIR)/xscope_capture.exe
+
+"$(DLLDIR)/xscope_mock_endpoint.dll": $(MOCK_OBJS)
+    $(LINK32) $(LINK32_LIBS) /DLL /nologo /out:"$(DLLDIR)/xscope_mock_endpoint.dll" @<<
+    $(LINKFLAGS) $(MOCK_OBJS)
+<<
+
+"$(BINDIR)/xscope_capture.exe": $(CAPTURE_OBJS)
+    @echo Linking...
+    $(LINK32) @<<
+    $(EXE32_FLAGS) /out:"$(BINDIR)/xscope_capture.exe" $(CAPTURE_OBJS) $(TOOLS_ROOT)/lib/xscope_endpoint.lib
+<<
+
+.cpp{}.obj::
+    $(CPP) @<<
+    $(CFLAGS) -I$(TOOLS_ROOT)/include $<
+<<
+
+clean:
+    -@rm $(MOCK_OBJS) $(CAPTURE_OBJS) *.idb *.pdb 2> NUL
+    -@rm $(DLLDIR)/xscope_mock_endpoint.* 2> NUL
+    -@rm $(BINDIR)/xscope_capture.* 2> NUL
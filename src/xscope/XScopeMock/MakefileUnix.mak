@@ -0,0 +1,23 @@
+TOOLS_ROOT = ../../..
+include $(TOOLS_ROOT)/src/MakefileUnix.mak
+
+MOCK_OBJS = XScopeMock.o
+CAPTURE_OBJS = XScopeCapture.o
+CPPFLAGS_LOCAL = -std=c++11
+EXTRALIBS += -lpthread
+
+all: $(DLLDIR)/xscope_mock_endpoint$(DLLEXT) $(BINDIR)/xscope_capture
+
+$(DLLDIR)/xscope_mock_endpoint$(DLLEXT): $(MOCK_OBJS)
+	$(CCPP) $(MOCK_OBJS) -shared -o $(DLLDIR)/xscope_mock_endpoint$(DLLEXT) $(LIBS) $(EXTRALIBS)
+
+$(BINDIR)/xscope_capture: $(CAPTURE_OBJS)
+	$(CPP) $(CAPTURE_OBJS) -o $(BINDIR)/xscope_capture $(TOOLS_ROOT)/lib/xscope_endpoint$(DLLEXT) $(LIBS) $(EXTRALIBS)
+
+%.o: %.cpp
+	$(CPP) $(CPPFLAGS) -c $< -o $@ -I$(TOOLS_ROOT)/include
+
+clean: 
+	rm -rf $(MOCK_OBJS) $(CAPTURE_OBJS)
+	rm -rf $(DLLDIR)/xscope_mock_endpoint.*
+	rm -rf $(BINDIR)/xscope_capture
@@ -0,0 +1,158 @@
+/*
+ * Copyright XMOS Limited - 2024
+ *
+ * Records registrations, records and prints from a running xSCOPE server into
+ * a capture file which can be replayed by the xSCOPE mock endpoint.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "xscope_endpoint.h"
+#include "XScopeCaptureFile.h"
+
+using namespace std;
+
+typedef chrono::steady_clock capture_clock;
+
+static FILE *g_file = 0;
+static mutex g_file_mutex;
+static capture_clock::time_point g_start;
+static volatile sig_atomic_t g_done = 0;
+static unsigned long long g_num_entries = 0;
+static bool g_write_failed = false;
+
+void print_usage(const char *exe_name)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s <options> CAPTURE_FILE\n", exe_name);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  --help - print this message\n");
+  fprintf(stderr, "  --host <host> - xSCOPE server host name (default localhost)\n");
+  fprintf(stderr, "  --port <port> - xSCOPE server port (default 10234)\n");
+  fprintf(stderr, "  --time <seconds> - stop after this long (default: until interrupted)\n");
+  exit(1);
+}
+
+static void write_entry(XScopeCaptureEntry &e)
+{
+  lock_guard<mutex> lock(g_file_mutex);
+  e.host_ns = chrono::duration_cast<chrono::nanoseconds>(capture_clock::now() - g_start).count();
+  if (!capture_write_entry(g_file, e))
+    g_write_failed = true;
+  g_num_entries++;
+}
+
+static void on_register(unsigned int id, unsigned int type, unsigned int r, unsigned int g, unsigned int b,
+                        unsigned char *name, unsigned char *unit, unsigned int data_type, unsigned char *data_name)
+{
+  XScopeCaptureEntry e;
+  e.kind = XSCOPE_CAPTURE_REGISTER;
+  e.id = id;
+  e.type = type;
+  e.r = r;
+  e.g = g;
+  e.b = b;
+  e.data_type = data_type;
+  e.name = (const char *)name;
+  e.unit = (const char *)unit;
+  e.data_name = (const char *)data_name;
+  write_entry(e);
+}
+
+static void on_record(unsigned int id, unsigned long long timestamp, unsigned int length,
+                      unsigned long long dataval, unsigned char *databytes)
+{
+  XScopeCaptureEntry e;
+  e.kind = XSCOPE_CAPTURE_RECORD;
+  e.id = id;
+  e.timestamp = timestamp;
+  e.dataval = dataval;
+  if (length)
+    e.data.assign(databytes, databytes + length);
+  write_entry(e);
+}
+
+static void on_print(unsigned long long timestamp, unsigned int length, unsigned char *data)
+{
+  XScopeCaptureEntry e;
+  e.kind = XSCOPE_CAPTURE_PRINT;
+  e.timestamp = timestamp;
+  e.data.assign(data, data + length);
+  write_entry(e);
+}
+
+static void on_signal(int)
+{
+  g_done = 1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *host = "localhost";
+  const char *port = "10234";
+  const char *path = 0;
+  double seconds = 0;
+
+  for (int index = 1; index < argc; index++) {
+    if (strcmp(argv[index], "--help") == 0) {
+      print_usage(argv[0]);
+    } else if (strcmp(argv[index], "--host") == 0 && index + 1 < argc) {
+      host = argv[++index];
+    } else if (strcmp(argv[index], "--port") == 0 && index + 1 < argc) {
+      port = argv[++index];
+    } else if (strcmp(argv[index], "--time") == 0 && index + 1 < argc) {
+      seconds = atof(argv[++index]);
+    } else if (!path) {
+      path = argv[index];
+    } else {
+      print_usage(argv[0]);
+    }
+  }
+  if (!path)
+    print_usage(argv[0]);
+
+  g_file = fopen(path, "wb");
+  if (!g_file || !capture_write_header(g_file)) {
+    fprintf(stderr, "ERROR: failed to create capture file '%s'\n", path);
+    return 1;
+  }
+
+  xscope_ep_set_register_cb(on_register);
+  xscope_ep_set_record_cb(on_record);
+  xscope_ep_set_print_cb(on_print);
+
+  signal(SIGINT, on_signal);
+  g_start = capture_clock::now();
+
+  if (xscope_ep_connect(host, port) != XSCOPE_EP_SUCCESS) {
+    fprintf(stderr, "ERROR: failed to connect to xSCOPE server %s:%s\n", host, port);
+    fclose(g_file);
+    return 1;
+  }
+
+  while (!g_done) {
+    this_thread::sleep_for(chrono::milliseconds(100));
+    if (seconds > 0 && chrono::duration<double>(capture_clock::now() - g_start).count() >= seconds)
+      g_done = 1;
+  }
+
+  xscope_ep_disconnect();
+
+  lock_guard<mutex> lock(g_file_mutex);
+  fclose(g_file);
+  g_file = 0;
+
+  if (g_write_failed) {
+    fprintf(stderr, "ERROR: failed to write capture file '%s'\n", path);
+    return 1;
+  }
+  fprintf(stderr, "Captured %llu entries to '%s'\n", g_num_entries, path);
+  return 0;
+}
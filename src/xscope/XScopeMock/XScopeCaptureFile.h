@@ -0,0 +1,213 @@
+/*
+ * Copyright XMOS Limited - 2024
+ *
+ * xSCOPE capture file format, shared by the capture tool and the mock endpoint.
+ *
+ * A capture starts with XSCOPE_CAPTURE_MAGIC followed by a sequence of entries.
+ * Each entry starts with a kind byte and the host time in nanoseconds at which
+ * it was received, relative to the first entry. All values are little-endian.
+ *
+ *   REGISTER: u32 id, type, r, g, b, data_type
+ *             u16 name length, unit length, data name length, then the strings
+ *   RECORD:   u32 id, u64 timestamp, u32 length, u64 dataval, length data bytes
+ *   PRINT:    u64 timestamp, u32 length, length data bytes
+ *
+ */
+
+#ifndef _XScopeCaptureFile_H_
+#define _XScopeCaptureFile_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define XSCOPE_CAPTURE_MAGIC "XSCAP01\n"
+#define XSCOPE_CAPTURE_MAGIC_LEN 8
+
+enum XScopeCaptureKind
+{
+  XSCOPE_CAPTURE_REGISTER = 1,
+  XSCOPE_CAPTURE_RECORD = 2,
+  XSCOPE_CAPTURE_PRINT = 3,
+};
+
+struct XScopeCaptureEntry
+{
+  unsigned kind;
+  uint64_t host_ns;
+
+  // Registration
+  unsigned id;
+  unsigned type;
+  unsigned r, g, b;
+  unsigned data_type;
+  std::string name;
+  std::string unit;
+  std::string data_name;
+
+  // Record and print
+  uint64_t timestamp;
+  uint64_t dataval;
+  std::vector<unsigned char> data;
+};
+
+/*
+ * Low level helpers
+ */
+static inline bool capture_write_u16(FILE *f, uint16_t v)
+{
+  unsigned char b[2] = { (unsigned char)v, (unsigned char)(v >> 8) };
+  return fwrite(b, 1, 2, f) == 2;
+}
+
+static inline bool capture_write_u32(FILE *f, uint32_t v)
+{
+  unsigned char b[4];
+  for (int i = 0; i < 4; i++)
+    b[i] = (unsigned char)(v >> (8 * i));
+  return fwrite(b, 1, 4, f) == 4;
+}
+
+static inline bool capture_write_u64(FILE *f, uint64_t v)
+{
+  return capture_write_u32(f, (uint32_t)v) && capture_write_u32(f, (uint32_t)(v >> 32));
+}
+
+static inline bool capture_read_bytes(FILE *f, void *buf, size_t n)
+{
+  return fread(buf, 1, n, f) == n;
+}
+
+static inline bool capture_read_u16(FILE *f, uint16_t &v)
+{
+  unsigned char b[2];
+  if (!capture_read_bytes(f, b, 2))
+    return false;
+  v = (uint16_t)(b[0] | (b[1] << 8));
+  return true;
+}
+
+static inline bool capture_read_u32(FILE *f, uint32_t &v)
+{
+  unsigned char b[4];
+  if (!capture_read_bytes(f, b, 4))
+    return false;
+  v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+  return true;
+}
+
+static inline bool capture_read_u64(FILE *f, uint64_t &v)
+{
+  uint32_t lo, hi;
+  if (!capture_read_u32(f, lo) || !capture_read_u32(f, hi))
+    return false;
+  v = ((uint64_t)hi << 32) | lo;
+  return true;
+}
+
+static inline bool capture_read_string(FILE *f, uint16_t len, std::string &s)
+{
+  s.resize(len);
+  return len == 0 || capture_read_bytes(f, &s[0], len);
+}
+
+/*
+ * File level helpers
+ */
+static inline bool capture_write_header(FILE *f)
+{
+  return fwrite(XSCOPE_CAPTURE_MAGIC, 1, XSCOPE_CAPTURE_MAGIC_LEN, f) == XSCOPE_CAPTURE_MAGIC_LEN;
+}
+
+static inline bool capture_read_header(FILE *f)
+{
+  char magic[XSCOPE_CAPTURE_MAGIC_LEN];
+  if (!capture_read_bytes(f, magic, XSCOPE_CAPTURE_MAGIC_LEN))
+    return false;
+  return std::string(magic, XSCOPE_CAPTURE_MAGIC_LEN) == XSCOPE_CAPTURE_MAGIC;
+}
+
+static inline bool capture_write_entry(FILE *f, const XScopeCaptureEntry &e)
+{
+  bool ok = fputc(e.kind, f) != EOF && capture_write_u64(f, e.host_ns);
+
+  switch (e.kind) {
+    case XSCOPE_CAPTURE_REGISTER:
+      ok = ok && capture_write_u32(f, e.id) && capture_write_u32(f, e.type)
+              && capture_write_u32(f, e.r) && capture_write_u32(f, e.g) && capture_write_u32(f, e.b)
+              && capture_write_u32(f, e.data_type)
+              && capture_write_u16(f, (uint16_t)e.name.size())
+              && capture_write_u16(f, (uint16_t)e.unit.size())
+              && capture_write_u16(f, (uint16_t)e.data_name.size());
+      ok = ok && fwrite(e.name.data(), 1, e.name.size(), f) == e.name.size();
+      ok = ok && fwrite(e.unit.data(), 1, e.unit.size(), f) == e.unit.size();
+      ok = ok && fwrite(e.data_name.data(), 1, e.data_name.size(), f) == e.data_name.size();
+      break;
+
+    case XSCOPE_CAPTURE_RECORD:
+      ok = ok && capture_write_u32(f, e.id) && capture_write_u64(f, e.timestamp)
+              && capture_write_u32(f, (uint32_t)e.data.size()) && capture_write_u64(f, e.dataval);
+      ok = ok && fwrite(e.data.data(), 1, e.data.size(), f) == e.data.size();
+      break;
+
+    case XSCOPE_CAPTURE_PRINT:
+      ok = ok && capture_write_u64(f, e.timestamp) && capture_write_u32(f, (uint32_t)e.data.size());
+      ok = ok && fwrite(e.data.data(), 1, e.data.size(), f) == e.data.size();
+      break;
+
+    default:
+      ok = false;
+  }
+  return ok;
+}
+
+/*
+ * Returns false at the end of the file or on a truncated/invalid entry
+ */
+static inline bool capture_read_entry(FILE *f, XScopeCaptureEntry &e)
+{
+  int kind = fgetc(f);
+  if (kind == EOF)
+    return false;
+
+  e.kind = (unsigned)kind;
+  if (!capture_read_u64(f, e.host_ns))
+    return false;
+
+  uint32_t id, type, r, g, b, data_type, length;
+  uint16_t name_len, unit_len, data_name_len;
+
+  switch (e.kind) {
+    case XSCOPE_CAPTURE_REGISTER:
+      if (!capture_read_u32(f, id) || !capture_read_u32(f, type)
+          || !capture_read_u32(f, r) || !capture_read_u32(f, g) || !capture_read_u32(f, b)
+          || !capture_read_u32(f, data_type)
+          || !capture_read_u16(f, name_len) || !capture_read_u16(f, unit_len)
+          || !capture_read_u16(f, data_name_len))
+        return false;
+      e.id = id; e.type = type; e.r = r; e.g = g; e.b = b; e.data_type = data_type;
+      return capture_read_string(f, name_len, e.name)
+          && capture_read_string(f, unit_len, e.unit)
+          && capture_read_string(f, data_name_len, e.data_name);
+
+    case XSCOPE_CAPTURE_RECORD:
+      if (!capture_read_u32(f, id) || !capture_read_u64(f, e.timestamp)
+          || !capture_read_u32(f, length) || !capture_read_u64(f, e.dataval))
+        return false;
+      e.id = id;
+      e.data.resize(length);
+      return length == 0 || capture_read_bytes(f, e.data.data(), length);
+
+    case XSCOPE_CAPTURE_PRINT:
+      if (!capture_read_u64(f, e.timestamp) || !capture_read_u32(f, length))
+        return false;
+      e.data.resize(length);
+      return length == 0 || capture_read_bytes(f, e.data.data(), length);
+
+    default:
+      return false;
+  }
+}
+
+#endif /* _XScopeCaptureFile_H_ */
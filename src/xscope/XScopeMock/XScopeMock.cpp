@@ -0,0 +1,299 @@
+/*
+ * Copyright XMOS Limited - 2024
+ *
+ * A stand-in for the xSCOPE endpoint library which replays a capture file
+ * instead of connecting to a running xSCOPE server. It exports the same API
+ * as xscope_endpoint.h so host programs, and xscope.py, can be run against it
+ * without a device or xrun.
+ *
+ * Configuration is read from the environment when xscope_ep_connect is called:
+ *   XSCOPE_MOCK_CAPTURE  Capture file to replay (default: the ipaddr argument)
+ *   XSCOPE_MOCK_SPEED    Replay speed relative to capture time, 0 for as fast
+ *                        as possible (default 1.0)
+ *   XSCOPE_MOCK_LOOPS    Number of times to replay the records (default 1)
+ *   XSCOPE_MOCK_UPLOADS  File to which uploaded data is appended (optional)
+ *   XSCOPE_MOCK_VERBOSE  Print replay statistics on disconnect if set
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "xscope_endpoint.h"
+#include "XScopeCaptureFile.h"
+
+#define MAX_UPLOAD_BYTES 256
+
+using namespace std;
+
+/*
+ * Static data
+ */
+static xscope_ep_register_fptr s_register_cb = 0;
+static xscope_ep_record_fptr s_record_cb = 0;
+static xscope_ep_stats_fptr s_stats_cb = 0;
+static xscope_ep_print_fptr s_print_cb = 0;
+static xscope_ep_exit_fptr s_exit_cb = 0;
+
+static bool s_connected = false;
+static atomic<bool> s_stop(false);
+static thread s_replay_thread;
+static mutex s_upload_mutex;
+
+static vector<XScopeCaptureEntry> s_entries;
+static double s_speed = 1.0;
+static unsigned s_loops = 1;
+static string s_upload_path;
+static bool s_verbose = false;
+
+static unsigned long long s_num_records = 0;
+static unsigned long long s_num_uploads = 0;
+static double s_replay_seconds = 0;
+
+/*
+ * Static functions
+ */
+static bool load_capture(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "ERROR: failed to open xSCOPE capture '%s'\n", path);
+    return false;
+  }
+
+  if (!capture_read_header(f)) {
+    fprintf(stderr, "ERROR: '%s' is not an xSCOPE capture\n", path);
+    fclose(f);
+    return false;
+  }
+
+  s_entries.clear();
+  XScopeCaptureEntry entry;
+  while (capture_read_entry(f, entry))
+    s_entries.push_back(entry);
+
+  if (!feof(f))
+    fprintf(stderr, "WARNING: xSCOPE capture '%s' is truncated after %u entries\n",
+            path, (unsigned)s_entries.size());
+
+  fclose(f);
+  return true;
+}
+
+static void deliver(const XScopeCaptureEntry &e, uint64_t timestamp_offset)
+{
+  switch (e.kind) {
+    case XSCOPE_CAPTURE_REGISTER:
+      if (s_register_cb)
+        s_register_cb(e.id, e.type, e.r, e.g, e.b,
+                      (unsigned char *)e.name.c_str(), (unsigned char *)e.unit.c_str(),
+                      e.data_type, (unsigned char *)e.data_name.c_str());
+      break;
+
+    case XSCOPE_CAPTURE_RECORD:
+      if (s_record_cb)
+        s_record_cb(e.id, e.timestamp + timestamp_offset, (unsigned)e.data.size(), e.dataval,
+                    e.data.empty() ? 0 : (unsigned char *)e.data.data());
+      s_num_records++;
+      break;
+
+    case XSCOPE_CAPTURE_PRINT:
+      if (s_print_cb)
+        s_print_cb(e.timestamp + timestamp_offset, (unsigned)e.data.size(), (unsigned char *)e.data.data());
+      break;
+  }
+}
+
+static void replay()
+{
+  typedef chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+
+  // Registrations are only delivered once, like a real connection
+  for (size_t i = 0; i < s_entries.size() && !s_stop; i++) {
+    if (s_entries[i].kind == XSCOPE_CAPTURE_REGISTER)
+      deliver(s_entries[i], 0);
+  }
+
+  uint64_t last_timestamp = 0;
+  for (size_t i = 0; i < s_entries.size(); i++) {
+    if (s_entries[i].kind != XSCOPE_CAPTURE_REGISTER && s_entries[i].timestamp > last_timestamp)
+      last_timestamp = s_entries[i].timestamp;
+  }
+
+  uint64_t capture_ns = s_entries.empty() ? 0 : s_entries.back().host_ns;
+  for (unsigned loop = 0; loop < s_loops && !s_stop; loop++) {
+    // Keep timestamps monotonic across loops
+    uint64_t timestamp_offset = loop * (last_timestamp + 1);
+    double loop_start_ns = (double)loop * capture_ns;
+
+    for (size_t i = 0; i < s_entries.size() && !s_stop; i++) {
+      const XScopeCaptureEntry &e = s_entries[i];
+      if (e.kind == XSCOPE_CAPTURE_REGISTER)
+        continue;
+
+      if (s_speed > 0) {
+        double due_ns = (loop_start_ns + e.host_ns) / s_speed;
+        clock::time_point due = start + chrono::nanoseconds((long long)due_ns);
+        if (due > clock::now())
+          this_thread::sleep_until(due);
+      }
+      deliver(e, timestamp_offset);
+    }
+  }
+
+  s_replay_seconds = chrono::duration<double>(clock::now() - start).count();
+}
+
+/*
+ * Stops the replay if the host program exits without disconnecting
+ */
+struct ReplayGuard
+{
+  ~ReplayGuard()
+  {
+    s_stop = true;
+    if (s_replay_thread.joinable())
+      s_replay_thread.join();
+  }
+};
+static ReplayGuard s_replay_guard;
+
+/*
+ * Callback registration
+ */
+int xscope_ep_set_register_cb(xscope_ep_register_fptr registration)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+  s_register_cb = registration;
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_set_record_cb(xscope_ep_record_fptr record)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+  s_record_cb = record;
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_set_stats_cb(xscope_ep_stats_fptr stats)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+  s_stats_cb = stats;
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_set_print_cb(xscope_ep_print_fptr print)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+  s_print_cb = print;
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_set_exit_cb(xscope_ep_exit_fptr exit)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+  s_exit_cb = exit;
+  return XSCOPE_EP_SUCCESS;
+}
+
+/*
+ * Connect
+ */
+int xscope_ep_connect(const char *ipaddr, const char *port)
+{
+  if (s_connected)
+    return XSCOPE_EP_FAILURE;
+
+  const char *path = getenv("XSCOPE_MOCK_CAPTURE");
+  if (!path)
+    path = ipaddr;
+  if (!path || !load_capture(path))
+    return XSCOPE_EP_FAILURE;
+
+  const char *speed = getenv("XSCOPE_MOCK_SPEED");
+  s_speed = speed ? atof(speed) : 1.0;
+  const char *loops = getenv("XSCOPE_MOCK_LOOPS");
+  s_loops = loops ? (unsigned)strtoul(loops, 0, 0) : 1;
+  const char *uploads = getenv("XSCOPE_MOCK_UPLOADS");
+  s_upload_path = uploads ? uploads : "";
+  s_verbose = getenv("XSCOPE_MOCK_VERBOSE") != 0;
+
+  s_num_records = 0;
+  s_num_uploads = 0;
+  s_stop = false;
+  s_connected = true;
+  s_replay_thread = thread(replay);
+  return XSCOPE_EP_SUCCESS;
+}
+
+/*
+ * Disconnect
+ */
+int xscope_ep_disconnect(void)
+{
+  if (!s_connected)
+    return XSCOPE_EP_FAILURE;
+
+  s_stop = true;
+  s_replay_thread.join();
+  s_connected = false;
+
+  if (s_verbose) {
+    fprintf(stderr, "xSCOPE mock: %llu records in %.3f s (%.0f records/s), %llu uploads\n",
+            s_num_records, s_replay_seconds,
+            s_replay_seconds > 0 ? s_num_records / s_replay_seconds : 0.0, s_num_uploads);
+  }
+
+  if (s_exit_cb)
+    s_exit_cb();
+  return XSCOPE_EP_SUCCESS;
+}
+
+/*
+ * Requests
+ */
+int xscope_ep_request_registered(void)
+{
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_request_stats(void)
+{
+  if (!s_connected)
+    return XSCOPE_EP_FAILURE;
+  if (s_stats_cb)
+    s_stats_cb(0, 0xdeadbeef);
+  return XSCOPE_EP_SUCCESS;
+}
+
+int xscope_ep_request_upload(unsigned int length, const unsigned char *data)
+{
+  if (!s_connected || length > MAX_UPLOAD_BYTES)
+    return XSCOPE_EP_FAILURE;
+
+  lock_guard<mutex> lock(s_upload_mutex);
+  s_num_uploads++;
+
+  if (!s_upload_path.empty()) {
+    FILE *f = fopen(s_upload_path.c_str(), "ab");
+    if (!f)
+      return XSCOPE_EP_FAILURE;
+    bool ok = fwrite(data, 1, length, f) == length;
+    fclose(f);
+    if (!ok)
+      return XSCOPE_EP_FAILURE;
+  }
+  return XSCOPE_EP_SUCCESS;
+}
@@ -354,6 +354,98 @@ void xscope_core_stop_int(unsigned char id, unsigned int data);
 
 ///@}
 
+/**
+ * \defgroup xscope_batch_functions Functions for sending batches of samples to the host
+ *
+ * These accumulate samples for a probe in a caller-supplied buffer and send them as a single
+ * \ref xscope_bytes record once the buffer is full, so that a per-sample loop pays for a few stores
+ * rather than a full xSCOPE record per sample. The host endpoint unpacks batch records back into
+ * individual records, with timestamps spaced evenly between the first and last sample of the batch.
+ *
+ * Each logical core should use its own buffer. Example:
+ * \code
+ *    unsigned batch[XSCOPE_BATCH_WORDS(32)];
+ *    xscope_batch_init(batch);
+ *    for (int i = 0; i < 1000; i++) {
+ *      xscope_batch_int(0, batch, 32, i*i);
+ *    }
+ *    xscope_batch_flush(0, batch);
+ * \endcode
+ * @{
+ */
+
+/** Marker in the first word of a batch record. The low byte holds the sample count. */
+#define XSCOPE_BATCH_MAGIC 0x58534200
+
+/** Words of header at the start of a batch buffer: marker and count, first sample time, last sample time. */
+#define XSCOPE_BATCH_HEADER_WORDS 3
+
+/** Maximum number of samples in one batch record. */
+#define XSCOPE_BATCH_MAX_SAMPLES 60
+
+/** Size in words of a batch buffer holding \a n samples. */
+#define XSCOPE_BATCH_WORDS(n) ((n) + XSCOPE_BATCH_HEADER_WORDS)
+
+/** \cond */
+#ifdef __XC__
+#define _XSCOPE_BATCH_BYTES(buf) (buf, unsigned char[])
+#else
+#define _XSCOPE_BATCH_BYTES(buf) ((const unsigned char *)(buf))
+#endif
+
+static inline unsigned _xscope_batch_time(void)
+{
+  unsigned t;
+  asm volatile("gettime %0" : "=r"(t));
+  return t;
+}
+/** \endcond */
+
+/**
+ * Initialise an empty batch buffer. This must be called before the buffer is first used.
+ * \param buf Batch buffer of XSCOPE_BATCH_WORDS(n) words.
+ */
+static inline void xscope_batch_init(unsigned buf[])
+{
+  buf[0] = XSCOPE_BATCH_MAGIC;
+}
+
+/**
+ * Send any samples held in a batch buffer to the host as a single record, and empty the buffer.
+ * \param id xSCOPE probe id.
+ * \param buf Batch buffer.
+ */
+static inline void xscope_batch_flush(unsigned char id, unsigned buf[])
+{
+  unsigned count = buf[0] & 0xff;
+  if (count) {
+    xscope_bytes(id, (XSCOPE_BATCH_HEADER_WORDS + count) * sizeof(unsigned), _XSCOPE_BATCH_BYTES(buf));
+    buf[0] = XSCOPE_BATCH_MAGIC;
+  }
+}
+
+/**
+ * Add a sample of type int to a batch buffer, sending the batch to the host once it holds \a n samples.
+ * \param id xSCOPE probe id.
+ * \param buf Batch buffer of XSCOPE_BATCH_WORDS(n) words.
+ * \param n Number of samples per batch record, at most XSCOPE_BATCH_MAX_SAMPLES.
+ * \param data User data value (int).
+ */
+static inline void xscope_batch_int(unsigned char id, unsigned buf[], unsigned n, unsigned int data)
+{
+  unsigned count = buf[0] & 0xff;
+  unsigned now = _xscope_batch_time();
+  if (count == 0)
+    buf[1] = now;
+  buf[2] = now;
+  buf[XSCOPE_BATCH_HEADER_WORDS + count] = data;
+  buf[0] += 1;
+  if (count + 1 >= n)
+    xscope_batch_flush(id, buf);
+}
+
+///@}
+
 /**
  * Put xSCOPE into a lossless mode where timing is no longer guaranteed.
  * If the logical core tries to send an xSCOPE packet which the xTAG does not have buffers for, then the